@@ -1,15 +1,89 @@
-#include <cglm/vec2.h>
+#include <hpa.h>
 #include <intlist.h>
 #include <jps.h>
+#include <limits.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <sys/time.h>
+#include <string.h>
 #include <time.h>
-#include <unistd.h>
 
-void load_map(struct map *m, const char *path) {
+// Same path type as the game, diagonals can't cut corners
+#define PATH_TYPE 2
+#define STRAIGHT_COST 5
+#define DIAGONAL_COST 7
+
+#define MIN_SIZE 64
+#define MAX_SIZE 2048
+#define DEFAULT_QUERIES 256
+#define DEFAULT_VALIDATED 32
+#define DEFAULT_SEED 0x6d616964656e6c65ull
+
+typedef enum map_kind_t {
+  MAP_OPEN,
+  MAP_ROOMS,
+  MAP_MAZE,
+  MAP_RANDOM,
+  MAP_FILE,
+} map_kind_t;
+
+static const char *map_kind_names[] = {
+    [MAP_OPEN] = "open",
+    [MAP_ROOMS] = "rooms",
+    [MAP_MAZE] = "maze",
+    [MAP_RANDOM] = "random",
+    [MAP_FILE] = "file",
+};
+
+typedef struct options_t {
+  unsigned queries;
+  unsigned validated;
+  unsigned max_size;
+  uint64_t seed;
+  const char *map_path;
+  unsigned cluster_size; // 0 for JPS alone
+  bool jump_table;       // run again with the JPS+ table, see --jps-plus
+} options_t;
+
+typedef struct results_t {
+  unsigned queries;
+  unsigned unreachable;
+  double *latencies; // in microseconds
+  unsigned long nodes;
+  unsigned max_nodes;
+  size_t max_search_bytes;
+
+  unsigned validated;
+  unsigned suboptimal;
+  unsigned invalid;
+} results_t;
+
+// Own generator so the maps don't depend on the libc rand
+static uint64_t next_random(uint64_t *state) {
+  uint64_t z = (*state += 0x9e3779b97f4a7c15ull);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+  return z ^ (z >> 31);
+}
+
+static unsigned random_below(uint64_t *state, unsigned bound) {
+  return next_random(state) % bound;
+}
+
+static double now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static bool load_map(struct jps_grid **out, const char *path) {
   FILE *f = fopen(path, "r");
+  if (!f) {
+    fprintf(stderr, "Couldn't open `%s`.\n", path);
+    return false;
+  }
+
   size_t size = 0;
   fseek(f, 0, SEEK_END);
   size = ftell(f);
@@ -20,16 +94,48 @@ void load_map(struct map *m, const char *path) {
   fread(data, 1, size, f);
   fclose(f);
 
-  unsigned x = 0;
+  // First pass to size the map
+  unsigned w = 0, h = 0, x = 0;
+  for (size_t i = 0; i < size; i++) {
+    if (data[i] == '\n') {
+      h++;
+      x = 0;
+    } else if (data[i] != '\r') {
+      x++;
+      if (x > w) {
+        w = x;
+      }
+    }
+  }
+  if (x != 0) {
+    h++;
+  }
+
+  if (w == 0 || h == 0) {
+    fprintf(stderr, "`%s` is empty.\n", path);
+    free(data);
+    return false;
+  }
+
+  struct jps_grid *g = jps_grid_create(w, h);
+
+  // Anything out of the lines is a wall
+  for (unsigned y = 0; y < h; y++) {
+    for (unsigned x = 0; x < w; x++) {
+      jps_set_obstacle(g, x, y, true);
+    }
+  }
+
+  x = 0;
   unsigned y = 0;
   for (size_t i = 0; i < size; i++) {
     switch (data[i]) {
     case '#': {
-      jps_set_obstacle(m, x, y, true);
+      jps_set_obstacle(g, x, y, true);
       break;
     }
     case ' ': {
-      jps_set_obstacle(m, x, y, false);
+      jps_set_obstacle(g, x, y, false);
       break;
     }
     case '\n': {
@@ -41,37 +147,605 @@ void load_map(struct map *m, const char *path) {
     }
     }
 
-    if (data[i] != '\n') {
+    if (data[i] != '\n' && data[i] != '\r') {
       x++;
     }
   }
+
+  free(data);
+  *out = g;
+
+  return true;
 }
 
-int main(int argc, char const *argv[]) {
+// Rooms of 16x16 separated by walls, with a door of random position in every
+// wall segment
+static void generate_rooms(struct jps_grid *g, uint64_t *rng) {
+  const int room = 16;
+  const int door = 4;
+  int w = g->width, h = g->height;
+
+  for (int y = 0; y < h; y++) {
+    for (int x = 0; x < w; x++) {
+      jps_set_obstacle(g, x, y, (x % room == 0 && x != 0) || (y % room == 0 && y != 0));
+    }
+  }
+
+  for (int ry = 0; ry < h; ry += room) {
+    for (int rx = 0; rx < w; rx += room) {
+      // Door in the wall on the right of the room
+      if (rx + room < w) {
+        int d = ry + 1 + random_below(rng, room - door - 1);
+        for (int i = 0; i < door; i++) {
+          jps_set_obstacle(g, rx + room, d + i, false);
+        }
+      }
+      // Door in the wall under the room
+      if (ry + room < h) {
+        int d = rx + 1 + random_below(rng, room - door - 1);
+        for (int i = 0; i < door; i++) {
+          jps_set_obstacle(g, d + i, ry + room, false);
+        }
+      }
+    }
+  }
+}
+
+// Perfect maze with 3 tiles wide corridors, carved by a depth first search
+static void generate_maze(struct jps_grid *g, uint64_t *rng) {
+  const int corridor = 3;
+  const int cell = corridor + 1;
+  int w = g->width, h = g->height;
+  int cw = (w - 1) / cell, ch = (h - 1) / cell;
+
+  for (int y = 0; y < h; y++) {
+    for (int x = 0; x < w; x++) {
+      jps_set_obstacle(g, x, y, true);
+    }
+  }
+
+  char *visited = calloc(cw * ch, 1);
+  int *stack = malloc(cw * ch * sizeof(int));
+  int top = 0;
+
+  stack[top++] = 0;
+  visited[0] = 1;
+
+  while (top > 0) {
+    int c = stack[top - 1];
+    int cx = c % cw, cy = c / cw;
+
+    for (int y = 0; y < corridor; y++) {
+      for (int x = 0; x < corridor; x++) {
+        jps_set_obstacle(g, 1 + cx * cell + x, 1 + cy * cell + y, false);
+      }
+    }
+
+    int neighbours[4];
+    int count = 0;
+    if (cx > 0 && !visited[c - 1]) {
+      neighbours[count++] = c - 1;
+    }
+    if (cx < cw - 1 && !visited[c + 1]) {
+      neighbours[count++] = c + 1;
+    }
+    if (cy > 0 && !visited[c - cw]) {
+      neighbours[count++] = c - cw;
+    }
+    if (cy < ch - 1 && !visited[c + cw]) {
+      neighbours[count++] = c + cw;
+    }
+
+    if (count == 0) {
+      top--;
+      continue;
+    }
+
+    int n = neighbours[random_below(rng, count)];
+    int nx = n % cw, ny = n / cw;
+
+    // Open the wall between both cells
+    for (int i = 0; i < corridor; i++) {
+      if (nx != cx) {
+        int wx = 1 + (cx > nx ? cx : nx) * cell - 1;
+        jps_set_obstacle(g, wx, 1 + cy * cell + i, false);
+      } else {
+        int wy = 1 + (cy > ny ? cy : ny) * cell - 1;
+        jps_set_obstacle(g, 1 + cx * cell + i, wy, false);
+      }
+    }
+
+    visited[n] = 1;
+    stack[top++] = n;
+  }
+
+  free(stack);
+  free(visited);
+}
+
+static void generate_random(struct jps_grid *g, uint64_t *rng) {
+  for (int y = 0; y < g->height; y++) {
+    for (int x = 0; x < g->width; x++) {
+      jps_set_obstacle(g, x, y, random_below(rng, 100) < 30);
+    }
+  }
+}
+
+static struct jps_grid *generate_map(map_kind_t kind, unsigned size,
+                                     uint64_t seed) {
+  uint64_t rng = seed ^ ((uint64_t)kind << 32) ^ size;
+  struct jps_grid *g = jps_grid_create(size, size);
+
+  switch (kind) {
+  case MAP_ROOMS: {
+    generate_rooms(g, &rng);
+    break;
+  }
+  case MAP_MAZE: {
+    generate_maze(g, &rng);
+    break;
+  }
+  case MAP_RANDOM: {
+    generate_random(g, &rng);
+    break;
+  }
+  default: {
+    break;
+  }
+  }
+
+  return g;
+}
+
+// Memory held by the map whatever the query: the shared grid, see
+// jps_grid_create, and the search context of the single thread, see jps_create
+static size_t map_bytes(struct map *m) {
+  size_t len = m->width * m->height;
+  size_t grid = sizeof(struct jps_grid) + len / 8 + 1 +
+                len * (2 * sizeof(int) + sizeof(unsigned)) +
+                (m->height * m->grid->row_words +
+                 m->width * m->grid->column_words) * sizeof(uint64_t);
+  if (m->grid->jumps) {
+    grid += len * 8 * sizeof(short);
+  }
+  size_t context = sizeof(struct map) + jps_get_memory_len(len) +
+                   len * sizeof(struct jps_node);
+  return grid + context;
+}
+
+// Clusters and entrances of the hierarchical layer, see hpa_create, and the
+// search context of the single thread, see hpa_search_create
+static size_t hpa_bytes(struct hpa_search *s) {
+  if (!s) {
+    return 0;
+  }
+
+  struct hpa *h = s->hpa;
+  size_t clusters = h->columns * h->rows;
+  size_t layer = sizeof(struct hpa) + clusters * (sizeof(struct hpa_cluster) + sizeof(int) +
+                                                  h->max_nodes * (sizeof(int) + 1));
+  for (size_t i = 0; i < clusters; i++) {
+    layer += h->clusters[i].dist_capacity * sizeof(unsigned);
+  }
+  size_t context = sizeof(struct hpa_search) + clusters * h->max_nodes * sizeof(struct hpa_state);
+  return layer + context;
+}
+
+// Open set nodes and heap entries allocated by the last search
+static size_t search_bytes(struct map *m) {
+  return il_size(m->il) * (4 + 1) * sizeof(int);
+}
+
+static bool walkable(struct map *m, int x, int y) {
+  return jps_is_obstacle(m->grid, x, y) == 0;
+}
+
+// Diagonal moves need both orthogonal neighbours to be free
+static bool can_move(struct map *m, int x, int y, int dx, int dy) {
+  if (!walkable(m, x + dx, y + dy)) {
+    return false;
+  }
+  if (dx != 0 && dy != 0) {
+    return walkable(m, x + dx, y) && walkable(m, x, y + dy);
+  }
+  return true;
+}
+
+typedef struct dijkstra_t {
+  int *cost;
+  int *heap; // positions, ordered by cost
+  unsigned heap_count;
+  unsigned heap_capacity;
+} dijkstra_t;
+
+static void dijkstra_push(dijkstra_t *d, int pos) {
+  if (d->heap_count == d->heap_capacity) {
+    d->heap_capacity *= 2;
+    d->heap = realloc(d->heap, d->heap_capacity * sizeof(int));
+  }
+
+  unsigned i = d->heap_count++;
+  while (i > 0) {
+    unsigned parent = (i - 1) / 2;
+    if (d->cost[d->heap[parent]] <= d->cost[pos]) {
+      break;
+    }
+    d->heap[i] = d->heap[parent];
+    i = parent;
+  }
+  d->heap[i] = pos;
+}
+
+static int dijkstra_pop(dijkstra_t *d) {
+  int top = d->heap[0];
+  int last = d->heap[--d->heap_count];
+
+  unsigned i = 0;
+  for (;;) {
+    unsigned child = i * 2 + 1;
+    if (child >= d->heap_count) {
+      break;
+    }
+    if (child + 1 < d->heap_count &&
+        d->cost[d->heap[child + 1]] < d->cost[d->heap[child]]) {
+      child++;
+    }
+    if (d->cost[last] <= d->cost[d->heap[child]]) {
+      break;
+    }
+    d->heap[i] = d->heap[child];
+    i = child;
+  }
+  d->heap[i] = last;
+
+  return top;
+}
+
+// Reference cost of the shortest path, -1 when unreachable. Lazy deletion:
+// positions are pushed again when their cost improves.
+static int dijkstra(dijkstra_t *d, struct map *m, int start, int end) {
+  int w = m->width;
+  int len = w * m->height;
+
+  for (int i = 0; i < len; i++) {
+    d->cost[i] = INT_MAX;
+  }
+  d->heap_count = 0;
+
+  char *done = calloc(len, 1);
+
+  d->cost[start] = 0;
+  dijkstra_push(d, start);
+
+  int result = -1;
+  while (d->heap_count) {
+    int pos = dijkstra_pop(d);
+    if (done[pos]) {
+      continue;
+    }
+    done[pos] = 1;
+
+    if (pos == end) {
+      result = d->cost[pos];
+      break;
+    }
+
+    int x = pos % w, y = pos / w;
+    for (int dy = -1; dy <= 1; dy++) {
+      for (int dx = -1; dx <= 1; dx++) {
+        if ((dx == 0 && dy == 0) || !can_move(m, x, y, dx, dy)) {
+          continue;
+        }
+
+        int next = pos + dy * w + dx;
+        int cost = d->cost[pos] + (dx && dy ? DIAGONAL_COST : STRAIGHT_COST);
+        if (cost < d->cost[next]) {
+          d->cost[next] = cost;
+          dijkstra_push(d, next);
+        }
+      }
+    }
+  }
+
+  free(done);
+
+  return result;
+}
+
+// Walk the path tile by tile and return its cost, -1 when it goes through a
+// wall, cuts a corner or doesn't join start and end. The list is in reverse
+// order and doesn't hold the start.
+static int path_cost(struct map *m, IntList *path, int start, int end) {
+  int w = m->width;
+  int x = start % w, y = start / w;
+  int cost = 0;
+
+  for (int i = il_size(path) - 1; i >= 0; i--) {
+    int tx = il_get(path, i, 0);
+    int ty = il_get(path, i, 1);
+    int dx = (tx > x) - (tx < x);
+    int dy = (ty > y) - (ty < y);
+    int adx = abs(tx - x), ady = abs(ty - y);
+
+    // Jump points are joined by straight or diagonal lines only
+    if (adx != 0 && ady != 0 && adx != ady) {
+      return -1;
+    }
+
+    while (x != tx || y != ty) {
+      if (!can_move(m, x, y, dx, dy)) {
+        return -1;
+      }
+      x += dx;
+      y += dy;
+      cost += dx && dy ? DIAGONAL_COST : STRAIGHT_COST;
+    }
+  }
+
+  if (x + y * w != end) {
+    return -1;
+  }
+
+  return cost;
+}
+
+static int random_free_tile(struct map *m, uint64_t *rng) {
+  int len = m->width * m->height;
+  for (;;) {
+    int pos = random_below(rng, len);
+    if (walkable(m, pos % m->width, pos / m->width)) {
+      return pos;
+    }
+  }
+}
+
+static int compare_double(const void *a, const void *b) {
+  double da = *(const double *)a, db = *(const double *)b;
+  return (da > db) - (da < db);
+}
+
+static double percentile(double *sorted, unsigned count, double p) {
+  if (count == 0) {
+    return 0.0;
+  }
+  unsigned i = (unsigned)(p * (count - 1) + 0.5);
+  return sorted[i];
+}
+
+static void run_queries(struct map *m, struct hpa_search *hpa,
+                        const options_t *options, uint64_t seed,
+                        results_t *results) {
+  uint64_t rng = seed;
+  int len = m->width * m->height;
+
+  dijkstra_t reference = {
+      .cost = malloc(len * sizeof(int)),
+      .heap = malloc(1024 * sizeof(int)),
+      .heap_capacity = 1024,
+  };
+
+  IntList *path = il_create(2);
+
+  // Free tiles are needed to place queries
+  bool has_free_tile = false;
+  for (int pos = 0; pos < len && !has_free_tile; pos++) {
+    has_free_tile = walkable(m, pos % m->width, pos / m->width);
+  }
+
+  results->latencies = calloc(options->queries, sizeof(double));
+
+  // Like the grid, the clusters are built before the game searches anything
+  if (hpa) {
+    hpa_build(hpa->hpa);
+  }
+
+  for (unsigned q = 0; has_free_tile && q < options->queries; q++) {
+    int start = random_free_tile(m, &rng);
+    int end = random_free_tile(m, &rng);
+
+    jps_set_start(m, start % m->width, start / m->width);
+    jps_set_end(m, end % m->width, end / m->width);
+
+    il_clear(path);
+
+    double before = now_us();
+    int error = hpa ? hpa_path_finding(hpa, m, PATH_TYPE, path)
+                    : jps_path_finding(m, PATH_TYPE, path);
+    double after = now_us();
+
+    unsigned expanded = hpa ? hpa->expanded + hpa->refined : m->expanded;
+    results->latencies[results->queries++] = after - before;
+    results->nodes += expanded;
+    if (expanded > results->max_nodes) {
+      results->max_nodes = expanded;
+    }
+    if (search_bytes(m) > results->max_search_bytes) {
+      results->max_search_bytes = search_bytes(m);
+    }
+    if (error) {
+      results->unreachable++;
+    }
+
+    if (q >= options->validated) {
+      continue;
+    }
+
+    results->validated++;
+
+    int expected = dijkstra(&reference, m, start, end);
+    if (error) {
+      if (expected >= 0) {
+        printf("  (%d,%d) to (%d,%d): no path found, expected cost %d\n",
+               start % m->width, start / m->width, end % m->width,
+               end / m->width, expected);
+        results->invalid++;
+      }
+      continue;
+    }
+
+    int cost = path_cost(m, path, start, end);
+    if (cost < 0 || expected < 0) {
+      printf("  (%d,%d) to (%d,%d): invalid path\n", start % m->width,
+             start / m->width, end % m->width, end / m->width);
+      results->invalid++;
+    } else if (cost != expected) {
+      results->suboptimal++;
+    }
+  }
+
+  il_destroy(path);
+  free(reference.heap);
+  free(reference.cost);
+}
+
+static void print_header(const options_t *options) {
+  printf("%-7s %9s %7s %7s %9s %9s %9s %9s %9s %9s %9s %9s %9s %9s", "map",
+         "size", "queries", "unreach", "p50 us", "p95 us", "p99 us", "max us",
+         "nodes", "max nodes", "map KB", "search KB", "validated",
+         "subopt");
+  if (options->jump_table) {
+    printf(" %9s", "speedup");
+  }
+  printf("\n");
+}
 
-  ivec2 starts[] = {
-      [0] = {103, 16}, [1] = {92, 61}, [2] = {66, 33},
-      [3] = {13, 15},  [4] = {15, 3},
+// With a baseline, also prints how many times faster the median query is
+static void print_results(const char *name, struct map *m,
+                          struct hpa_search *hpa, results_t *results,
+                          results_t *baseline) {
+  qsort(results->latencies, results->queries, sizeof(double), compare_double);
+
+  char size[32];
+  sprintf(size, "%dx%d", m->width, m->height);
+
+  printf("%-7s %9s %7u %7u %9.1f %9.1f %9.1f %9.1f %9.1f %9u %9zu %9zu %9u %9u",
+         name, size, results->queries, results->unreachable,
+         percentile(results->latencies, results->queries, 0.50),
+         percentile(results->latencies, results->queries, 0.95),
+         percentile(results->latencies, results->queries, 0.99),
+         percentile(results->latencies, results->queries, 1.00),
+         results->queries ? (double)results->nodes / results->queries : 0.0,
+         results->max_nodes, (map_bytes(m) + hpa_bytes(hpa)) / 1024,
+         results->max_search_bytes / 1024, results->validated,
+         results->suboptimal);
+  if (baseline) {
+    double before = percentile(baseline->latencies, baseline->queries, 0.50);
+    double after = percentile(results->latencies, results->queries, 0.50);
+    printf(" %8.2fx", after > 0.0 ? before / after : 0.0);
+  }
+  printf("\n");
+}
+
+// Runs the queries on the map, then again with the jump table when asked, and
+// returns the invalid paths found
+static unsigned run_map(const char *name, struct jps_grid *g,
+                        const options_t *options, uint64_t seed) {
+  struct map *m = jps_create(g);
+  struct hpa *h = options->cluster_size ? hpa_create(g, options->cluster_size) : NULL;
+  struct hpa_search *s = h ? hpa_search_create(h) : NULL;
+
+  results_t results = {0};
+  run_queries(m, s, options, seed, &results);
+  print_results(name, m, s, &results, NULL);
+  unsigned invalid = results.invalid;
+
+  // Same queries, the table is built before them like the clusters
+  if (options->jump_table) {
+    jps_build_jump_table(g);
+
+    char plus[32];
+    snprintf(plus, sizeof(plus), "%s+", name);
+    results_t table = {0};
+    run_queries(m, s, options, seed, &table);
+    print_results(plus, m, s, &table, &results);
+    invalid += table.invalid;
+    free(table.latencies);
+  }
+
+  free(results.latencies);
+  if (h) {
+    hpa_search_destroy(s);
+    hpa_destroy(h);
+  }
+  jps_destroy(m);
+  return invalid;
+}
+
+static void usage(const char *program) {
+  printf("Usage: %s [options]\n"
+         "  --queries <n>   queries per map (default %d)\n"
+         "  --validate <n>  queries checked against Dijkstra per map (default %d)\n"
+         "  --max-size <n>  largest generated map side (default %d)\n"
+         "  --seed <n>      seed of the maps and queries\n"
+         "  --map <file>    only run on a text map, `#` for walls\n"
+         "  --hpa <n>       search through clusters of n tiles, like the game\n"
+         "  --jps-plus      run every map again with the JPS+ jump table\n",
+         program, DEFAULT_QUERIES, DEFAULT_VALIDATED, MAX_SIZE);
+}
+
+int main(int argc, char const *argv[]) {
+  options_t options = {
+      .queries = DEFAULT_QUERIES,
+      .validated = DEFAULT_VALIDATED,
+      .max_size = MAX_SIZE,
+      .seed = DEFAULT_SEED,
   };
 
-  struct map *m = jps_create(256, 256);
-  time_t seed = time(NULL);
-  srand(seed);
+  for (int i = 1; i < argc; i++) {
+    bool has_value = i + 1 < argc;
+    if (!strcmp(argv[i], "--queries") && has_value) {
+      options.queries = strtoul(argv[++i], NULL, 0);
+    } else if (!strcmp(argv[i], "--validate") && has_value) {
+      options.validated = strtoul(argv[++i], NULL, 0);
+    } else if (!strcmp(argv[i], "--max-size") && has_value) {
+      options.max_size = strtoul(argv[++i], NULL, 0);
+    } else if (!strcmp(argv[i], "--seed") && has_value) {
+      options.seed = strtoull(argv[++i], NULL, 0);
+    } else if (!strcmp(argv[i], "--map") && has_value) {
+      options.map_path = argv[++i];
+    } else if (!strcmp(argv[i], "--hpa") && has_value) {
+      options.cluster_size = strtoul(argv[++i], NULL, 0);
+    } else if (!strcmp(argv[i], "--jps-plus")) {
+      options.jump_table = true;
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  printf("seed 0x%llx, %u queries per map, %u validated, ",
+         (unsigned long long)options.seed, options.queries, options.validated);
+  if (options.cluster_size) {
+    printf("clusters of %u tiles\n\n", options.cluster_size);
+  } else {
+    printf("JPS alone\n\n");
+  }
+  print_header(&options);
+
+  unsigned invalid = 0;
 
-  load_map(m, "../benchmark/map1.txt");
+  if (options.map_path) {
+    struct jps_grid *g;
+    if (!load_map(&g, options.map_path)) {
+      return 1;
+    }
+    invalid += run_map(map_kind_names[MAP_FILE], g, &options, options.seed);
+    jps_grid_destroy(g);
 
-  for (unsigned j = 0; j < 3000; j++) {
-    int s = rand() % 4;
-    int e = rand() % 4;
-    jps_set_start(m, starts[s][0], starts[s][1]);
-    jps_set_end(m, starts[e][0], starts[e][1]);
+    return invalid != 0;
+  }
 
-    IntList *list = il_create(2);
-    if (jps_path_finding(m, 2, list) != 0) {
-      printf("something went wrong... %d to %d\n", s, e);
+  for (map_kind_t kind = MAP_OPEN; kind < MAP_FILE; kind++) {
+    for (unsigned size = MIN_SIZE; size <= options.max_size; size *= 2) {
+      struct jps_grid *g = generate_map(kind, size, options.seed);
+      invalid += run_map(map_kind_names[kind], g, &options, options.seed ^ size);
+      jps_grid_destroy(g);
     }
-    il_destroy(list);
   }
 
-  return 0;
+  if (invalid) {
+    printf("\n%u invalid paths.\n", invalid);
+  }
+
+  return invalid != 0;
 }
@@ -138,7 +138,6 @@ heap_peek(heap_t *h) {
 void
 heap_clear(heap_t *h) {
     h->count = 0;
-    memset(h->array, 0, h->size * sizeof(h->array[0]));
 }
 
 int
@@ -0,0 +1,640 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hpa.h"
+
+#define STRAIGHT_COST 5
+#define DIAGONAL_COST 7
+
+// Entrances as wide as that get one transition at each end instead of a single
+// one in the middle
+#define WIDE_ENTRANCE 6
+
+// More than the cost of any step, see local_dijkstra
+#define LOCAL_BUCKETS 8
+
+enum { SIDE_TOP = 0, SIDE_RIGHT, SIDE_BOTTOM, SIDE_LEFT, SIDE_NUM };
+
+static const int side_dx[SIDE_NUM] = {0, 1, 0, -1};
+static const int side_dy[SIDE_NUM] = {-1, 0, 1, 0};
+
+// Dijkstra scratch over the tiles of one cluster
+struct hpa_local {
+  unsigned *cost; // cluster_size * cluster_size
+  unsigned long long *heap;
+  int heap_count;
+  // Free tiles of the cluster loaded by local_load, with a blocked border so
+  // the flood never checks bounds
+  unsigned char *open; // (cluster_size + 2) * (cluster_size + 2)
+};
+
+static int free_tile(struct jps_grid *g, int x, int y) {
+  return jps_is_obstacle(g, x, y) == 0;
+}
+
+// Min heap of cost << 32 | item, entries are pushed again when their cost
+// improves and skipped when popped late
+static void keys_push(unsigned long long *heap, int *count, unsigned long long key) {
+  int i = (*count)++;
+  while (i > 0) {
+    int parent = (i - 1) / 2;
+    if (heap[parent] <= key) {
+      break;
+    }
+    heap[i] = heap[parent];
+    i = parent;
+  }
+  heap[i] = key;
+}
+
+static unsigned long long keys_pop(unsigned long long *heap, int *count) {
+  unsigned long long top = heap[0];
+  unsigned long long last = heap[--(*count)];
+
+  int i = 0;
+  for (;;) {
+    int child = i * 2 + 1;
+    if (child >= *count) {
+      break;
+    }
+    if (child + 1 < *count && heap[child + 1] < heap[child]) {
+      child++;
+    }
+    if (last <= heap[child]) {
+      break;
+    }
+    heap[i] = heap[child];
+    i = child;
+  }
+  heap[i] = last;
+
+  return top;
+}
+
+static struct hpa_local *local_create(int cluster_size) {
+  struct hpa_local *l = (struct hpa_local *)malloc(sizeof(struct hpa_local));
+  int len = cluster_size * cluster_size;
+  l->cost = (unsigned *)malloc(len * sizeof(unsigned));
+  // Every tile is pushed at most once per neighbour
+  l->heap = (unsigned long long *)malloc((len * 8 + 1) * sizeof(unsigned long long));
+  l->heap_count = 0;
+  l->open = (unsigned char *)malloc((cluster_size + 2) * (cluster_size + 2));
+  return l;
+}
+
+static void local_destroy(struct hpa_local *l) {
+  free(l->cost);
+  free(l->open);
+  free(l->heap);
+  free(l);
+}
+
+static int local_index(struct hpa_cluster *c, int w, int pos) {
+  return (pos / w - c->y) * c->width + (pos % w - c->x);
+}
+
+// Copy the obstacles of the cluster from the row bitboards, for local_dijkstra
+static void local_load(struct jps_grid *g, struct hpa_cluster *c,
+                       struct hpa_local *l) {
+  int stride = c->width + 2;
+  memset(l->open, 0, stride * (c->height + 2));
+
+  for (int y = 0; y < c->height; y++) {
+    const uint64_t *row = &g->rows[(c->y + y) * g->row_words];
+    unsigned char *open = &l->open[(y + 1) * stride + 1];
+    for (int x = 0; x < c->width; x++) {
+      int gx = c->x + x;
+      open[x] = !((row[gx / 64] >> (gx % 64)) & 1);
+    }
+  }
+}
+
+// Costs from `source` to every tile of the cluster loaded last, without
+// leaving it
+static void local_dijkstra(struct jps_grid *g, struct hpa_cluster *c,
+                           struct hpa_local *l, int source) {
+  int len = c->width * c->height;
+  memset(l->cost, 0xff, len * sizeof(unsigned));
+  l->heap_count = 0;
+
+  int stride = c->width + 2;
+  // Neighbours in the padded grid, the diagonals last with the two sides they
+  // must not cut
+  const int step[8] = {-stride, 1, stride, -1,
+                       -stride + 1, stride + 1, stride - 1, -stride - 1};
+  const int local_step[8] = {-c->width, 1, c->width, -1,
+                             -c->width + 1, c->width + 1, c->width - 1, -c->width - 1};
+  const int side_a[8] = {0, 0, 0, 0, -stride, stride, stride, -stride};
+  const int side_b[8] = {0, 0, 0, 0, 1, 1, -1, -1};
+
+  // Steps cost less than LOCAL_BUCKETS, so a ring of buckets by cost is
+  // enough to pop tiles in order. Their entries live in the heap storage,
+  // next entry << 32 | tile.
+  int head[LOCAL_BUCKETS];
+  for (int b = 0; b < LOCAL_BUCKETS; b++) {
+    head[b] = -1;
+  }
+  int pending = 0;
+
+  int first = local_index(c, g->width, source);
+  l->cost[first] = 0;
+  l->heap[l->heap_count] = (unsigned long long)(unsigned)head[0] << 32 | first;
+  head[0] = l->heap_count++;
+  pending++;
+
+  for (unsigned cost = 0; pending; cost++) {
+    int *bucket = &head[cost % LOCAL_BUCKETS];
+    while (*bucket != -1) {
+      unsigned long long entry = l->heap[*bucket];
+      *bucket = (int)(entry >> 32);
+      pending--;
+
+      int idx = entry & 0xffffffff;
+      if (cost != l->cost[idx]) {
+        continue;
+      }
+
+      const unsigned char *open = &l->open[(idx / c->width + 1) * stride + idx % c->width + 1];
+      for (int d = 0; d < 8; d++) {
+        if (!open[step[d]]) {
+          continue;
+        }
+        // Diagonals don't cut corners
+        if (d >= 4 && (!open[side_a[d]] || !open[side_b[d]])) {
+          continue;
+        }
+
+        int next = idx + local_step[d];
+        unsigned next_cost = cost + (d >= 4 ? DIAGONAL_COST : STRAIGHT_COST);
+        if (next_cost < l->cost[next]) {
+          l->cost[next] = next_cost;
+          int *next_bucket = &head[next_cost % LOCAL_BUCKETS];
+          l->heap[l->heap_count] = (unsigned long long)(unsigned)*next_bucket << 32 | next;
+          *next_bucket = l->heap_count++;
+          pending++;
+        }
+      }
+    }
+  }
+}
+
+static void add_entrance(struct hpa *h, struct hpa_cluster *c, int pos, int side) {
+  for (int i = 0; i < c->node_count; i++) {
+    if (c->nodes[i] == pos) {
+      c->sides[i] |= 1 << side;
+      return;
+    }
+  }
+
+  assert(c->node_count < h->max_nodes);
+  c->nodes[c->node_count] = pos;
+  c->sides[c->node_count] = 1 << side;
+  c->node_count++;
+}
+
+// Free tiles facing each other across a side come in runs, each one gets
+// entrances. Both clusters scan their common side the same way, so they agree
+// on where its entrances are.
+static void scan_side(struct hpa *h, struct hpa_cluster *c, int side) {
+  struct jps_grid *g = h->grid;
+  int horizontal = side == SIDE_TOP || side == SIDE_BOTTOM;
+  int len = horizontal ? c->width : c->height;
+  int edge_x = side == SIDE_RIGHT ? c->x + c->width - 1 : c->x;
+  int edge_y = side == SIDE_BOTTOM ? c->y + c->height - 1 : c->y;
+
+  // Borders of the map have nothing behind
+  if (jps_is_obstacle(g, edge_x + side_dx[side], edge_y + side_dy[side]) < 0) {
+    return;
+  }
+
+  int run = -1;
+  for (int i = 0; i <= len; i++) {
+    int x = horizontal ? c->x + i : edge_x;
+    int y = horizontal ? edge_y : c->y + i;
+    int open = i < len && free_tile(g, x, y) &&
+               free_tile(g, x + side_dx[side], y + side_dy[side]);
+
+    if (open && run < 0) {
+      run = i;
+    } else if (!open && run >= 0) {
+      int last = i - 1;
+      int ends[2] = {run, last};
+      int count = 2;
+      if (last - run + 1 < WIDE_ENTRANCE) {
+        ends[0] = (run + last) / 2;
+        count = 1;
+      }
+      for (int e = 0; e < count; e++) {
+        int ex = horizontal ? c->x + ends[e] : edge_x;
+        int ey = horizontal ? edge_y : c->y + ends[e];
+        add_entrance(h, c, ey * g->width + ex, side);
+      }
+      run = -1;
+    }
+  }
+}
+
+static void build_cluster(struct hpa *h, struct hpa_cluster *c) {
+  c->node_count = 0;
+  for (int side = 0; side < SIDE_NUM; side++) {
+    scan_side(h, c, side);
+  }
+
+  int n = c->node_count;
+  if (n * n > c->dist_capacity) {
+    free(c->dist);
+    c->dist = (unsigned *)malloc(n * n * sizeof(unsigned));
+    c->dist_capacity = n * n;
+  }
+
+  local_load(h->grid, c, h->local);
+  for (int i = 0; i < n; i++) {
+    local_dijkstra(h->grid, c, h->local, c->nodes[i]);
+    for (int j = 0; j < n; j++) {
+      c->dist[i * n + j] = h->local->cost[local_index(c, h->grid->width, c->nodes[j])];
+    }
+  }
+
+  c->dirty = 0;
+}
+
+static void mark_dirty(struct hpa *h, int cx, int cy) {
+  int index = cy * h->columns + cx;
+  if (!h->clusters[index].dirty) {
+    h->clusters[index].dirty = 1;
+    h->dirty[h->dirty_count++] = index;
+  }
+}
+
+// Searches of several threads may get there at once, only one builds the
+// clusters
+void hpa_build(struct hpa *h) {
+  if (atomic_load_explicit(&h->ready, memory_order_acquire)) {
+    return;
+  }
+  while (atomic_flag_test_and_set_explicit(&h->lock, memory_order_acquire)) {
+  }
+  if (!atomic_load_explicit(&h->ready, memory_order_relaxed)) {
+    for (int i = 0; i < h->dirty_count; i++) {
+      build_cluster(h, &h->clusters[h->dirty[i]]);
+    }
+    h->dirty_count = 0;
+    atomic_store_explicit(&h->ready, 1, memory_order_release);
+  }
+  atomic_flag_clear_explicit(&h->lock, memory_order_release);
+}
+
+struct hpa *hpa_create(struct jps_grid *grid, int cluster_size) {
+  assert(cluster_size > 0);
+  struct hpa *h = (struct hpa *)malloc(sizeof(struct hpa));
+  h->grid = grid;
+  h->cluster_size = cluster_size;
+  h->columns = (grid->width + cluster_size - 1) / cluster_size;
+  h->rows = (grid->height + cluster_size - 1) / cluster_size;
+  // Runs are at least a tile apart, and have two entrances at most
+  h->max_nodes = SIDE_NUM * (cluster_size / 2 + 1);
+
+  int count = h->columns * h->rows;
+  h->clusters = (struct hpa_cluster *)calloc(count, sizeof(struct hpa_cluster));
+  h->node_storage = (int *)malloc(count * h->max_nodes * sizeof(int));
+  h->side_storage = (unsigned char *)malloc(count * h->max_nodes);
+  h->dirty = (int *)malloc(count * sizeof(int));
+  h->dirty_count = 0;
+  h->local = local_create(cluster_size);
+  atomic_init(&h->ready, 0);
+  atomic_flag_clear(&h->lock);
+
+  for (int cy = 0; cy < h->rows; cy++) {
+    for (int cx = 0; cx < h->columns; cx++) {
+      struct hpa_cluster *c = &h->clusters[cy * h->columns + cx];
+      c->x = cx * cluster_size;
+      c->y = cy * cluster_size;
+      c->width = grid->width - c->x < cluster_size ? grid->width - c->x : cluster_size;
+      c->height = grid->height - c->y < cluster_size ? grid->height - c->y : cluster_size;
+      c->nodes = h->node_storage + (cy * h->columns + cx) * h->max_nodes;
+      c->sides = h->side_storage + (cy * h->columns + cx) * h->max_nodes;
+      mark_dirty(h, cx, cy);
+    }
+  }
+
+  return h;
+}
+
+void hpa_destroy(struct hpa *h) {
+  for (int i = 0; i < h->columns * h->rows; i++) {
+    free(h->clusters[i].dist);
+  }
+  free(h->clusters);
+  free(h->node_storage);
+  free(h->side_storage);
+  free(h->dirty);
+  local_destroy(h->local);
+
+  free(h);
+}
+
+void hpa_update(struct hpa *h, int x, int y) {
+  if (x < 0 || y < 0 || x >= h->grid->width || y >= h->grid->height) {
+    return;
+  }
+
+  int cx = x / h->cluster_size;
+  int cy = y / h->cluster_size;
+  struct hpa_cluster *c = &h->clusters[cy * h->columns + cx];
+  mark_dirty(h, cx, cy);
+
+  // Entrances of a side depend on the tiles of both clusters
+  if (x == c->x && cx > 0) {
+    mark_dirty(h, cx - 1, cy);
+  }
+  if (x == c->x + c->width - 1 && cx + 1 < h->columns) {
+    mark_dirty(h, cx + 1, cy);
+  }
+  if (y == c->y && cy > 0) {
+    mark_dirty(h, cx, cy - 1);
+  }
+  if (y == c->y + c->height - 1 && cy + 1 < h->rows) {
+    mark_dirty(h, cx, cy + 1);
+  }
+
+  atomic_store_explicit(&h->ready, 0, memory_order_release);
+}
+
+struct hpa_search *hpa_search_create(struct hpa *h) {
+  struct hpa_search *s = (struct hpa_search *)malloc(sizeof(struct hpa_search));
+  int count = h->columns * h->rows * h->max_nodes;
+  s->hpa = h;
+  // Generation 0 is never used by a search, every state starts stale
+  s->generation = 0;
+  s->states = (struct hpa_state *)calloc(count, sizeof(struct hpa_state));
+  s->heap_capacity = 1024;
+  s->heap = (unsigned long long *)malloc(s->heap_capacity * sizeof(unsigned long long));
+  s->heap_count = 0;
+  s->from_start = (unsigned *)malloc(h->max_nodes * sizeof(unsigned));
+  s->to_end = (unsigned *)malloc(h->max_nodes * sizeof(unsigned));
+  s->waypoint_capacity = 64;
+  s->waypoints = (int *)malloc(s->waypoint_capacity * sizeof(int));
+  s->local = local_create(h->cluster_size);
+  s->expanded = 0;
+  s->refined = 0;
+  return s;
+}
+
+void hpa_search_destroy(struct hpa_search *s) {
+  free(s->states);
+  free(s->heap);
+  free(s->from_start);
+  free(s->to_end);
+  free(s->waypoints);
+  local_destroy(s->local);
+
+  free(s);
+}
+
+static struct hpa_cluster *cluster_of(struct hpa *h, int pos) {
+  int x = pos % h->grid->width;
+  int y = pos / h->grid->width;
+  return &h->clusters[(y / h->cluster_size) * h->columns + x / h->cluster_size];
+}
+
+static unsigned heuristic(int w, int from, int to) {
+  int dx = abs(from % w - to % w);
+  int dy = abs(from / w - to / w);
+  int diagonal = dx < dy ? dx : dy;
+  return diagonal * DIAGONAL_COST + (dx + dy - 2 * diagonal) * STRAIGHT_COST;
+}
+
+static struct hpa_state *touch(struct hpa_search *s, int id) {
+  struct hpa_state *state = &s->states[id];
+  if (state->generation != s->generation) {
+    state->generation = s->generation;
+    state->g = HPA_UNREACHABLE;
+    state->parent = -1;
+    state->closed = 0;
+  }
+  return state;
+}
+
+static void relax(struct hpa_search *s, int id, int pos, unsigned g, int parent,
+                  int end) {
+  struct hpa_state *state = touch(s, id);
+  if (state->closed || g >= state->g) {
+    return;
+  }
+  state->g = g;
+  state->parent = parent;
+
+  if (s->heap_count == s->heap_capacity) {
+    s->heap_capacity *= 2;
+    s->heap = (unsigned long long *)realloc(
+        s->heap, s->heap_capacity * sizeof(unsigned long long));
+  }
+  unsigned f = g + heuristic(s->hpa->grid->width, pos, end);
+  keys_push(s->heap, &s->heap_count, (unsigned long long)f << 32 | id);
+}
+
+static void push_waypoint(struct hpa_search *s, int *count, int pos) {
+  if (*count == s->waypoint_capacity) {
+    s->waypoint_capacity *= 2;
+    s->waypoints = (int *)realloc(s->waypoints, s->waypoint_capacity * sizeof(int));
+  }
+  s->waypoints[(*count)++] = pos;
+}
+
+// A* over the entrances, from the ones the start reaches in its cluster to the
+// ones reaching the end in its cluster. Fill the waypoints from the end to the
+// start, and return their count, or -1 when the end wasn't reached.
+static int abstract_search(struct hpa_search *s, int start, int end) {
+  struct hpa *h = s->hpa;
+  int w = h->grid->width;
+
+  struct hpa_cluster *cs = cluster_of(h, start);
+  struct hpa_cluster *ce = cluster_of(h, end);
+  int start_cluster = cs - h->clusters;
+
+  local_load(h->grid, cs, s->local);
+  local_dijkstra(h->grid, cs, s->local, start);
+  for (int i = 0; i < cs->node_count; i++) {
+    s->from_start[i] = s->local->cost[local_index(cs, w, cs->nodes[i])];
+  }
+  local_load(h->grid, ce, s->local);
+  local_dijkstra(h->grid, ce, s->local, end);
+  for (int i = 0; i < ce->node_count; i++) {
+    s->to_end[i] = s->local->cost[local_index(ce, w, ce->nodes[i])];
+  }
+
+  // Forget the previous search by moving to the next generation, only clear
+  // the stamps when it wraps around
+  s->generation++;
+  if (s->generation == 0) {
+    memset(s->states, 0,
+           h->columns * h->rows * h->max_nodes * sizeof(struct hpa_state));
+    s->generation = 1;
+  }
+  s->heap_count = 0;
+
+  for (int i = 0; i < cs->node_count; i++) {
+    if (s->from_start[i] != HPA_UNREACHABLE) {
+      relax(s, start_cluster * h->max_nodes + i, cs->nodes[i], s->from_start[i],
+            -1, end);
+    }
+  }
+
+  unsigned best = HPA_UNREACHABLE;
+  int best_id = -1;
+  while (s->heap_count) {
+    unsigned long long key = keys_pop(s->heap, &s->heap_count);
+    unsigned f = key >> 32;
+    int id = key & 0xffffffff;
+    struct hpa_state *state = &s->states[id];
+    if (state->closed) {
+      continue;
+    }
+    // Nothing left can beat the way found to the end
+    if (f >= best) {
+      break;
+    }
+    state->closed = 1;
+    s->expanded++;
+
+    int ci = id / h->max_nodes;
+    int ni = id % h->max_nodes;
+    struct hpa_cluster *c = &h->clusters[ci];
+    int pos = c->nodes[ni];
+    unsigned g = state->g;
+
+    if (c == ce && s->to_end[ni] != HPA_UNREACHABLE && g + s->to_end[ni] < best) {
+      best = g + s->to_end[ni];
+      best_id = id;
+    }
+
+    // Other entrances of the cluster
+    for (int j = 0; j < c->node_count; j++) {
+      unsigned d = c->dist[ni * c->node_count + j];
+      if (j != ni && d != HPA_UNREACHABLE) {
+        relax(s, ci * h->max_nodes + j, c->nodes[j], g + d, id, end);
+      }
+    }
+
+    // And the tiles facing it in the next clusters
+    for (int side = 0; side < SIDE_NUM; side++) {
+      if (!(c->sides[ni] & (1 << side))) {
+        continue;
+      }
+      int next = pos + side_dy[side] * w + side_dx[side];
+      struct hpa_cluster *n = cluster_of(h, next);
+      for (int j = 0; j < n->node_count; j++) {
+        if (n->nodes[j] == next) {
+          relax(s, (n - h->clusters) * h->max_nodes + j, next,
+                g + STRAIGHT_COST, id, end);
+          break;
+        }
+      }
+    }
+  }
+
+  if (best_id < 0) {
+    return -1;
+  }
+
+  int count = 0;
+  push_waypoint(s, &count, end);
+  for (int id = best_id; id != -1; id = s->states[id].parent) {
+    struct hpa_cluster *c = &h->clusters[id / h->max_nodes];
+    push_waypoint(s, &count, c->nodes[id % h->max_nodes]);
+  }
+  push_waypoint(s, &count, start);
+
+  return count;
+}
+
+// Append the way from `from` to `to` to `out`, like jps_path_finding does
+static int refine(struct hpa_search *s, struct map *m, int type, int from,
+                  int to, IntList *out) {
+  int w = m->width;
+  if (from == to) {
+    return 0;
+  }
+
+  // Steps from an entrance to the next cluster
+  if (abs(from % w - to % w) + abs(from / w - to / w) == 1) {
+    int idx = il_push_back(out);
+    il_set(out, idx, 0, to % w);
+    il_set(out, idx, 1, to / w);
+    return 0;
+  }
+
+  // Both are in the same cluster, jumps in open areas would scan the whole map
+  // otherwise
+  struct hpa_cluster *c = cluster_of(s->hpa, from);
+  jps_set_window(m, c->x, c->y, c->x + c->width - 1, c->y + c->height - 1);
+  jps_set_start(m, from % w, from / w);
+  jps_set_end(m, to % w, to / w);
+  int error = jps_path_finding(m, type, out);
+  s->refined += m->expanded;
+  return error;
+}
+
+int hpa_path_finding(struct hpa_search *s, struct map *m, int type,
+                     IntList *out) {
+  struct hpa *h = s->hpa;
+  int w = m->width;
+  int start = m->start;
+  int end = m->end;
+  s->expanded = 0;
+  s->refined = 0;
+
+  if (jps_is_obstacle(m->grid, start % w, start / w)) {
+    return 1;
+  }
+  if (jps_is_obstacle(m->grid, end % w, end / w)) {
+    return 2;
+  }
+  if (start == end) {
+    return 0;
+  }
+  if (!jps_is_reachable(m->grid, start % w, start / w, end % w, end / w)) {
+    return 4;
+  }
+
+  // Small maps and close ends are left to JPS, the jump table gets there
+  // sooner than flooding the clusters for their entrances
+  int dx = abs(start % w - end % w);
+  int dy = abs(start / w - end / w);
+  int octile = dx > dy ? STRAIGHT_COST * dx + (DIAGONAL_COST - STRAIGHT_COST) * dy
+                       : STRAIGHT_COST * dy + (DIAGONAL_COST - STRAIGHT_COST) * dx;
+  int side = m->width > m->height ? m->width : m->height;
+  if (side < HPA_MIN_SIDE ||
+      octile < STRAIGHT_COST * HPA_MIN_CLUSTERS * h->cluster_size) {
+    int error = jps_path_finding(m, type, out);
+    s->refined = m->expanded;
+    return error;
+  }
+
+  hpa_build(h);
+
+  int count = abstract_search(s, start, end);
+  int listed = il_size(out);
+  int error = count < 0;
+
+  // The list goes from the end to the start, so are the waypoints
+  for (int i = 0; !error && i + 1 < count; i++) {
+    error = refine(s, m, type, s->waypoints[i + 1], s->waypoints[i], out);
+  }
+
+  jps_set_window(m, 0, 0, m->width - 1, m->height - 1);
+  jps_set_start(m, start % w, start / w);
+  jps_set_end(m, end % w, end / w);
+
+  // Shouldn't happen, the entrances cover every way between clusters
+  if (error) {
+    while (il_size(out) > listed) {
+      il_pop_back(out);
+    }
+    error = jps_path_finding(m, type, out);
+    s->refined += m->expanded;
+  }
+
+  return error;
+}
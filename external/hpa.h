@@ -0,0 +1,108 @@
+#ifndef __HPA__
+#define __HPA__
+
+#include <stdatomic.h>
+
+#include "intlist.h"
+#include "jps.h"
+
+#define HPA_UNREACHABLE 0xffffffffu
+
+// Below either, JPS alone is faster than building the entrances of the clusters
+// and searching through them: the smallest map side, and the smallest distance
+// between the ends, in clusters
+#define HPA_MIN_SIDE 512
+#define HPA_MIN_CLUSTERS 4
+
+struct hpa_local;
+
+// A square of the map. Its entrances are the free tiles of its border facing a
+// free tile of the next cluster, linked together by their distances without
+// leaving the cluster.
+struct hpa_cluster {
+  int x;
+  int y;
+  int width;
+  int height;
+
+  int node_count;
+  int *nodes;           // tile of every entrance
+  unsigned char *sides; // sides crossed by every entrance, 1 << side
+  unsigned *dist;       // node_count * node_count
+  int dist_capacity;
+  int dirty;
+};
+
+// Hierarchical layer over the obstacles of a grid, for searches far away. Tell
+// it about every obstacle change with hpa_update, the clusters around are
+// built again by the next search.
+struct hpa {
+  struct jps_grid *grid;
+  int cluster_size;
+  int columns;
+  int rows;
+  // Entrances a single cluster may hold
+  int max_nodes;
+  struct hpa_cluster *clusters;
+  int *node_storage;
+  unsigned char *side_storage;
+
+  // Clusters to build before the next search, the first search builds them all
+  atomic_char ready;
+  atomic_flag lock;
+  int *dirty;
+  int dirty_count;
+  struct hpa_local *local;
+};
+
+// Search state of an entrance, only meaningful when stamped with the generation
+// of the running search
+struct hpa_state {
+  unsigned generation;
+  unsigned g;
+  int parent;
+  int closed;
+};
+
+// Scratch of a single search, one per thread searching the layer
+struct hpa_search {
+  struct hpa *hpa;
+
+  // Entrances are numbered cluster * max_nodes + index in the cluster
+  unsigned generation;
+  struct hpa_state *states;
+  unsigned long long *heap;
+  int heap_count;
+  int heap_capacity;
+
+  unsigned *from_start;
+  unsigned *to_end;
+  int *waypoints;
+  int waypoint_capacity;
+  struct hpa_local *local;
+
+  // Entrances popped, and JPS nodes popped to refine the way between them, by
+  // the last hpa_path_finding
+  int expanded;
+  int refined;
+};
+
+struct hpa *hpa_create(struct jps_grid *grid, int cluster_size);
+void hpa_destroy(struct hpa *h);
+// The obstacle of the tile changed
+void hpa_update(struct hpa *h, int x, int y);
+// Build the clusters changed since the last search now, instead of during the
+// next one
+void hpa_build(struct hpa *h);
+
+struct hpa_search *hpa_search_create(struct hpa *h);
+void hpa_search_destroy(struct hpa_search *s);
+
+// Same as jps_path_finding, from the start to the end of `m`. On maps of
+// HPA_MIN_SIDE and more, ends HPA_MIN_CLUSTERS clusters apart are joined through
+// the entrances first, and JPS only runs between consecutive ones: the path may
+// be a bit longer than the shortest.
+int hpa_path_finding(struct hpa_search *s, struct map *m, int type,
+                     IntList *out);
+
+#endif // __HPA__
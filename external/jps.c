@@ -1,5 +1,6 @@
 #include <assert.h>
 #include <limits.h>
+#include <stdatomic.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -19,15 +20,19 @@
 #define BITCLEAR(a, b) ((a)[BITSLOT(b)] &= ~BITMASK(b))
 #define BITTEST(a, b) ((a)[BITSLOT(b)] & BITMASK(b))
 
+#define OBSTACLE(m, pos) BITTEST((m)->grid->m, pos)
+
 enum { NODE_POS = 0, NODE_G, NODE_F, NODE_DIR, NODE_SIZE };
 
+enum { NODE_UNSEEN = -1, NODE_CLOSED = -2 };
+
 enum { TYPE_INIT = 0, OBS_CONNER_OK = 1, OBS_CONNER_AVOID, TYPE_NUM };
 
 int jps_get_memory_len(int len) {
 #ifdef DEBUG
-  return (BITSLOT(len) + 1) * 3;
+  return BITSLOT(len) + 1;
 #else
-  return (BITSLOT(len) + 1) * 2;
+  return 0;
 #endif
 }
 
@@ -39,47 +44,69 @@ static inline int check_in_map_pos(int pos, int limit) {
   return pos >= 0 && pos < limit;
 }
 
-int jps_set_obstacle(struct map *m, int x, int y, int bit) {
-  if (!check_in_map(x, y, m->width, m->height)) {
+static void connect_cell(struct jps_grid *g, int pos);
+static void disconnect_cell(struct jps_grid *g, int pos);
+static void update_jumps(struct jps_grid *g, int x, int y);
+
+int jps_set_obstacle(struct jps_grid *g, int x, int y, int bit) {
+  if (!check_in_map(x, y, g->width, g->height)) {
     return -1;
   }
+  int pos = g->width * y + x;
+  if (!BITTEST(g->m, pos) == !bit) {
+    return 0;
+  }
+  g->revision++;
+  // Components are only maintained once a search needed them, building a map
+  // obstacle by obstacle doesn't pay for it
+  int connected = atomic_load_explicit(&g->mark_connected, memory_order_relaxed);
+  uint64_t *row = &g->rows[y * g->row_words + x / 64];
+  uint64_t *column = &g->columns[x * g->column_words + y / 64];
   if (bit) {
-    BITSET(m->m, m->width * y + x);
+    BITSET(g->m, pos);
+    *row |= 1ull << (x % 64);
+    *column |= 1ull << (y % 64);
+    if (connected) {
+      disconnect_cell(g, pos);
+    }
   } else {
-    BITCLEAR(m->m, m->width * y + x);
+    BITCLEAR(g->m, pos);
+    *row &= ~(1ull << (x % 64));
+    *column &= ~(1ull << (y % 64));
+    if (connected) {
+      connect_cell(g, pos);
+    }
+  }
+  if (g->jumps) {
+    update_jumps(g, x, y);
   }
-  m->mark_connected = 0;
-#ifdef DEBUG
-  int len = m->width * m->height;
-  memset(&m->m[(BITSLOT(len) + 1) * 2], 0,
-         (BITSLOT(len) + 1) * sizeof(m->m[0]));
-#endif // DEBUG
   return 0;
 }
 
-int jps_is_obstacle(struct map *m, int x, int y) {
-  int pos = m->width * y + x;
-  if (!check_in_map(x, y, m->width, m->height)) {
+int jps_is_obstacle(struct jps_grid *g, int x, int y) {
+  int pos = g->width * y + x;
+  if (!check_in_map(x, y, g->width, g->height)) {
     return -1;
   }
-  if (BITTEST(m->m, pos)) {
+  if (BITTEST(g->m, pos)) {
     return 1;
   } else {
     return 0;
   }
 }
 
-void jps_clearall_obs(struct map *m) {
+void jps_clearall_obs(struct jps_grid *g) {
   int i;
-  for (i = 0; i < m->width * m->height; i++) {
-    BITCLEAR(m->m, i);
+  for (i = 0; i < g->width * g->height; i++) {
+    BITCLEAR(g->m, i);
+  }
+  memset(g->rows, 0, g->height * g->row_words * sizeof(uint64_t));
+  memset(g->columns, 0, g->width * g->column_words * sizeof(uint64_t));
+  g->revision++;
+  atomic_store_explicit(&g->mark_connected, 0, memory_order_relaxed);
+  if (g->jumps) {
+    jps_build_jump_table(g);
   }
-  m->mark_connected = 0;
-#ifdef DEBUG
-  int len = m->width * m->height;
-  memset(&m->m[(BITSLOT(len) + 1) * 2], 0,
-         (BITSLOT(len) + 1) * sizeof(m->m[0]));
-#endif // DEBUG
 }
 
 int jps_set_start(struct map *m, int x, int y) {
@@ -87,14 +114,13 @@ int jps_set_start(struct map *m, int x, int y) {
     return -1;
   }
   int pos = m->width * y + x;
-  if (BITTEST(m->m, pos)) {
+  if (OBSTACLE(m, pos)) {
     return -1;
   }
   m->start = pos;
 #ifdef DEBUG
   int len = m->width * m->height;
-  memset(&m->m[(BITSLOT(len) + 1) * 2], 0,
-         (BITSLOT(len) + 1) * sizeof(m->m[0]));
+  memset(m->m, 0, (BITSLOT(len) + 1) * sizeof(m->m[0]));
 #endif // DEBUG
   return 0;
 }
@@ -104,18 +130,24 @@ int jps_set_end(struct map *m, int x, int y) {
     return -1;
   }
   int pos = m->width * y + x;
-  if (BITTEST(m->m, pos)) {
+  if (OBSTACLE(m, pos)) {
     return -1;
   }
   m->end = pos;
 #ifdef DEBUG
   int len = m->width * m->height;
-  memset(&m->m[(BITSLOT(len) + 1) * 2], 0,
-         (BITSLOT(len) + 1) * sizeof(m->m[0]));
+  memset(m->m, 0, (BITSLOT(len) + 1) * sizeof(m->m[0]));
 #endif // DEBUG
   return 0;
 }
 
+void jps_set_window(struct map *m, int x0, int y0, int x1, int y1) {
+  m->min_x = x0 > 0 ? x0 : 0;
+  m->min_y = y0 > 0 ? y0 : 0;
+  m->max_x = x1 < m->width - 1 ? x1 : m->width - 1;
+  m->max_y = y1 < m->height - 1 ? y1 : m->height - 1;
+}
+
 static int dist(int one, int two, int w) {
   int ex = one % w, ey = one / w;
   int px = two % w, py = two / w;
@@ -133,6 +165,18 @@ static int dist(int one, int two, int w) {
   }
 }
 
+// Cells hold what the previous searches left, until the current one stamps
+// them with its generation
+static inline struct jps_node *touch(struct map *m, int pos) {
+  struct jps_node *node = &m->nodes[pos];
+  if (node->generation != m->generation) {
+    node->generation = m->generation;
+    node->comefrom = -1;
+    node->open_set = NODE_UNSEEN;
+  }
+  return node;
+}
+
 static void add_to_openset(struct map *m, int pos, int g_value,
                            unsigned char dir) {
   int idx = il_push_back(m->il);
@@ -141,7 +185,7 @@ static void add_to_openset(struct map *m, int pos, int g_value,
   il_set(m->il, idx, NODE_F, g_value + dist(m->end, pos, m->width));
   il_set(m->il, idx, NODE_DIR, dir);
   heap_insert(&m->h, idx);
-  m->open_set_map[pos] = idx;
+  m->nodes[pos].open_set = idx;
 }
 
 static void insert_mid_jump_point(struct map *m, int cur, int father, int w,
@@ -179,8 +223,7 @@ static void insert_mid_jump_point(struct map *m, int cur, int father, int w,
     my = father / w + span;
   }
 #ifdef DEBUG
-  int len = m->width * m->height;
-  BITSET(m->m, (BITSLOT(len) + 1) * 2 * CHAR_BIT + mx + my * w);
+  BITSET(m->m, mx + my * w);
 #endif // DEBUG
   int idx = il_push_back(out);
   il_set(out, idx, 0, mx);
@@ -193,21 +236,20 @@ static void form_path(int last, struct map *m, IntList *out) {
   int w = m->width;
 #ifdef DEBUG
   int len = m->width * m->height;
-  memset(&m->m[(BITSLOT(len) + 1) * 2], 0,
-         (BITSLOT(len) + 1) * sizeof(m->m[0]));
+  memset(m->m, 0, (BITSLOT(len) + 1) * sizeof(m->m[0]));
 #endif // DEBUG
   int idx;
-  while (m->comefrom[pos] != -1) {
+  while (m->nodes[pos].comefrom != -1) {
 #ifdef DEBUG
-    BITSET(m->m, (BITSLOT(len) + 1) * 2 * CHAR_BIT + pos);
+    BITSET(m->m, pos);
 #endif // DEBUG
     x = pos % w;
     y = pos / w;
     idx = il_push_back(out);
     il_set(out, idx, 0, x);
     il_set(out, idx, 1, y);
-    insert_mid_jump_point(m, pos, m->comefrom[pos], w, out);
-    pos = m->comefrom[pos];
+    insert_mid_jump_point(m, pos, m->nodes[pos].comefrom, w, out);
+    pos = m->nodes[pos].comefrom;
   }
 }
 
@@ -231,10 +273,12 @@ static inline void dir_add(unsigned char *dirs, unsigned char dir) {
 static inline int dir_is_diagonal(unsigned char dir) { return (dir % 2) != 0; }
 
 static inline int map_walkable(int pos, int limit, struct map *m) {
-  return check_in_map_pos(pos, limit) && !BITTEST(m->m, pos);
+  return check_in_map_pos(pos, limit) && !OBSTACLE(m, pos);
 }
 
-static int get_next_pos(int pos, unsigned char dir, int w, int h) {
+// Tiles out of the window are as good as walls
+static int get_next_pos(int pos, unsigned char dir, struct map *m) {
+  int w = m->width;
   int x = pos % w;
   int y = pos / w;
   switch (dir) {
@@ -269,7 +313,7 @@ static int get_next_pos(int pos, unsigned char dir, int w, int h) {
   default:
     return -1;
   }
-  if (!check_in_map(x, y, w, h)) {
+  if (x < m->min_x || y < m->min_y || x > m->max_x || y > m->max_y) {
     return -1;
   }
   return x + y * w;
@@ -277,7 +321,7 @@ static int get_next_pos(int pos, unsigned char dir, int w, int h) {
 
 static inline int walkable(struct map *m, int pos, int cur_dir, int next_dir) {
   return map_walkable(
-      get_next_pos(pos, (cur_dir + (next_dir)) % 8, m->width, m->height),
+      get_next_pos(pos, (cur_dir + (next_dir)) % 8, m),
       m->width * m->height, m);
 }
 
@@ -365,20 +409,21 @@ static unsigned char next_dir(unsigned char *dirs) {
   return NO_DIRECTION;
 }
 
-static void put_in_open_set(struct map *m, int pos, int len, int from,
+static void put_in_open_set(struct map *m, int pos, int from,
                             unsigned char dir) {
-  if (!BITTEST(m->m, (BITSLOT(len) + 1) * CHAR_BIT + pos)) {
+  struct jps_node *node = touch(m, pos);
+  if (node->open_set != NODE_CLOSED) {
     int g_value = il_get(m->il, from, NODE_G);
     int f_pos = il_get(m->il, from, NODE_POS);
     int ng_value = g_value + dist(pos, f_pos, m->width);
-    int p = m->open_set_map[pos];
+    int p = node->open_set;
     if (p < 0) {
-      m->comefrom[pos] = f_pos;
+      node->comefrom = f_pos;
       add_to_openset(m, pos, ng_value, dir);
     } else {
       int p_g_value = il_get(m->il, p, NODE_G);
       if (p_g_value > ng_value) {
-        m->comefrom[pos] = f_pos;
+        node->comefrom = f_pos;
         int p_f_value = il_get(m->il, p, NODE_F);
         il_set(m->il, p, NODE_F, p_f_value - (p_g_value - ng_value));
         il_set(m->il, p, NODE_G, ng_value);
@@ -393,25 +438,120 @@ static int conner_ok_obs(struct map *m, int pos, int new_pos,
                          unsigned char dir) {
   switch (dir) {
   case 1:
-    return BITTEST(m->m, pos + 1) || BITTEST(m->m, new_pos - 1);
+    return OBSTACLE(m, pos + 1) || OBSTACLE(m, new_pos - 1);
   case 3:
-    return BITTEST(m->m, pos + 1) || BITTEST(m->m, new_pos - 1);
+    return OBSTACLE(m, pos + 1) || OBSTACLE(m, new_pos - 1);
   case 5:
-    return BITTEST(m->m, pos - 1) || BITTEST(m->m, new_pos + 1);
+    return OBSTACLE(m, pos - 1) || OBSTACLE(m, new_pos + 1);
   case 7:
-    return BITTEST(m->m, pos - 1) || BITTEST(m->m, new_pos + 1);
+    return OBSTACLE(m, pos - 1) || OBSTACLE(m, new_pos + 1);
   default:
     return 0;
   }
   return 0;
 }
 
+// Free tiles of the word of a line, only those within [lo, hi]
+static inline uint64_t free_word(const uint64_t *line, int words, int i, int lo,
+                                 int hi) {
+  if (!line || i < 0 || i >= words) {
+    return 0;
+  }
+  int lo_bit = lo - i * 64, hi_bit = hi - i * 64;
+  if (hi_bit < 0 || lo_bit > 63) {
+    return 0;
+  }
+  uint64_t bits = ~line[i];
+  if (lo_bit > 0) {
+    bits &= ~0ull << lo_bit;
+  }
+  if (hi_bit < 63) {
+    bits &= ~0ull >> (63 - hi_bit);
+  }
+  return bits;
+}
+
+// Tiles of the word forced by a line next to the one scanned, see force_dir
+static inline uint64_t forced_word(const uint64_t *side, int words, int i,
+                                   int lo, int hi, int step, int type) {
+  if (!side) {
+    return 0;
+  }
+  uint64_t here = free_word(side, words, i, lo, hi);
+  uint64_t after = (here >> 1) | (free_word(side, words, i + 1, lo, hi) << 63);
+  uint64_t before = (here << 1) | (free_word(side, words, i - 1, lo, hi) >> 63);
+  if (type == OBS_CONNER_AVOID) {
+    return here & ~(step > 0 ? before : after);
+  }
+  return (step > 0 ? after : before) & ~here;
+}
+
+// jump_prune of a straight direction, 64 tiles at once: the next wall, forced
+// neighbour or end is the first bit set of the word
+static int jump_scan(int end, int pos, unsigned char dir, struct map *m,
+                     int from) {
+  struct jps_grid *g = m->grid;
+  int w = m->width;
+  int horizontal = dir == 2 || dir == 6;
+  int step = dir == 2 || dir == 4 ? 1 : -1;
+  // Rows are scanned along x, columns along y
+  const uint64_t *bits = horizontal ? g->rows : g->columns;
+  int words = horizontal ? g->row_words : g->column_words;
+  int line = horizontal ? pos / w : pos % w;
+  int t = (horizontal ? pos % w : pos / w) + step;
+  int lo = horizontal ? m->min_x : m->min_y;
+  int hi = horizontal ? m->max_x : m->max_y;
+  int across_lo = horizontal ? m->min_y : m->min_x;
+  int across_hi = horizontal ? m->max_y : m->max_x;
+  if (t < lo || t > hi) {
+    return 0;
+  }
+  const uint64_t *here = bits + line * words;
+  const uint64_t *side_a = line > across_lo ? here - words : NULL;
+  const uint64_t *side_b = line < across_hi ? here + words : NULL;
+  int end_t = -1;
+  if ((horizontal ? end / w : end % w) == line) {
+    end_t = horizontal ? end % w : end / w;
+  }
+
+  for (int i = t / 64; i >= 0 && i < words; i += step) {
+    uint64_t free_tiles = free_word(here, words, i, lo, hi);
+    uint64_t stop =
+        ~free_tiles |
+        forced_word(side_a, words, i, lo, hi, step, m->path_type) |
+        forced_word(side_b, words, i, lo, hi, step, m->path_type);
+    if (end_t >= 0 && end_t / 64 == i) {
+      stop |= 1ull << (end_t % 64);
+    }
+    // Behind the start doesn't count
+    if (i == t / 64) {
+      stop &= step > 0 ? ~0ull << (t % 64) : ~0ull >> (63 - t % 64);
+    }
+    if (!stop) {
+      continue;
+    }
+
+    int bit = step > 0 ? __builtin_ctzll(stop) : 63 - __builtin_clzll(stop);
+    int stop_t = i * 64 + bit;
+    int next_pos = horizontal ? line * w + stop_t : stop_t * w + line;
+    if (!(free_tiles >> bit & 1)) {
+      return 0;
+    }
+    put_in_open_set(m, next_pos, from, dir);
+    return next_pos == end;
+  }
+  return 0;
+}
+
 static int jump_prune(int end, int pos, unsigned char dir, struct map *m,
                       int from) {
+  if (!dir_is_diagonal(dir)) {
+    return jump_scan(end, pos, dir, m, from);
+  }
   int w = m->width;
   int h = m->height;
   int len = w * h;
-  int next_pos = get_next_pos(pos, dir, w, h);
+  int next_pos = get_next_pos(pos, dir, m);
   if (!map_walkable(next_pos, len, m)) {
     return 0;
   }
@@ -423,11 +563,11 @@ static int jump_prune(int end, int pos, unsigned char dir, struct map *m,
     }
   }
   if (next_pos == end) {
-    put_in_open_set(m, next_pos, len, from, dir);
+    put_in_open_set(m, next_pos, from, dir);
     return 1;
   }
   if (force_dir(next_pos, dir, m) != EMPTY_DIRECTIONSET) {
-    put_in_open_set(m, next_pos, len, from, dir);
+    put_in_open_set(m, next_pos, from, dir);
     return 0;
   }
   if (dir_is_diagonal(dir)) {
@@ -444,63 +584,418 @@ static int jump_prune(int end, int pos, unsigned char dir, struct map *m,
   return jump_prune(end, next_pos, dir, m, from);
 }
 
-static void flood_mark(struct map *m, int pos, int connected_num, int limit) {
-  char *visited = m->visited;
-  if (visited[pos]) {
+static const int jump_dx[8] = {0, 1, 1, 1, 0, -1, -1, -1};
+static const int jump_dy[8] = {-1, -1, 0, 1, 1, 1, 0, -1};
+
+static inline int grid_free(struct jps_grid *g, int x, int y) {
+  return check_in_map(x, y, g->width, g->height) &&
+         !BITTEST(g->m, x + y * g->width);
+}
+
+// force_dir of corner avoiding paths, without a window
+static int grid_forced(struct jps_grid *g, int x, int y, int dir) {
+  int a = (dir + 2) % 8, b = (dir + 3) % 8;
+  int c = (dir + 6) % 8, d = (dir + 5) % 8;
+  return (grid_free(g, x + jump_dx[a], y + jump_dy[a]) &&
+          !grid_free(g, x + jump_dx[b], y + jump_dy[b])) ||
+         (grid_free(g, x + jump_dx[c], y + jump_dy[c]) &&
+          !grid_free(g, x + jump_dx[d], y + jump_dy[d]));
+}
+
+// Entry of the cell, from the entry of the next cell in the direction
+static short jump_entry(struct jps_grid *g, int x, int y, int dir) {
+  int nx = x + jump_dx[dir], ny = y + jump_dy[dir];
+  if (!grid_free(g, nx, ny)) {
+    return 0;
+  }
+  short next = g->jumps[(nx + ny * g->width) * 8 + dir];
+  if (dir_is_diagonal(dir)) {
+    if (!grid_free(g, nx, y) || !grid_free(g, x, ny)) {
+      return 0;
+    }
+    return next + 1;
+  }
+  if (grid_forced(g, nx, ny, dir)) {
+    return 1;
+  }
+  return next > 0 ? next + 1 : next - 1;
+}
+
+// Fill the entries of the direction along the line through the cell, back
+// from its far end
+static void jump_line(struct jps_grid *g, int x, int y, int dir) {
+  int dx = jump_dx[dir], dy = jump_dy[dir];
+  if (!check_in_map(x, y, g->width, g->height)) {
     return;
   }
-  int *queue = m->queue;
-  memset(queue, 0, limit * sizeof(int));
+  while (check_in_map(x + dx, y + dy, g->width, g->height)) {
+    x += dx;
+    y += dy;
+  }
+  for (; check_in_map(x, y, g->width, g->height); x -= dx, y -= dy) {
+    g->jumps[(x + y * g->width) * 8 + dir] = jump_entry(g, x, y, dir);
+  }
+}
+
+// An obstacle changed: the entries that may see it are on the lines through
+// the cell and its neighbours, forced jump points depend on the next rows
+static void update_jumps(struct jps_grid *g, int x, int y) {
+  for (int dir = 0; dir < 8; dir++) {
+    for (int k = -1; k <= 1; k++) {
+      if (dir == 2 || dir == 6) {
+        jump_line(g, x, y + k, dir);
+      } else if (!dir_is_diagonal(dir)) {
+        jump_line(g, x + k, y, dir);
+      } else if (check_in_map(x + k, y, g->width, g->height)) {
+        jump_line(g, x + k, y, dir);
+      } else {
+        // The same diagonal, crossing the column of the cell instead
+        jump_line(g, x, y - k * jump_dx[dir] * jump_dy[dir], dir);
+      }
+    }
+  }
+}
+
+void jps_build_jump_table(struct jps_grid *g) {
+  // Entries are shorts
+  assert(g->width <= SHRT_MAX && g->height <= SHRT_MAX);
+  if (!g->jumps) {
+    g->jumps = (short *)malloc(g->width * g->height * 8 * sizeof(short));
+  }
+  for (int dir = 0; dir < 8; dir++) {
+    for (int y = 0; y < g->height; y++) {
+      for (int x = 0; x < g->width; x++) {
+        if (!check_in_map(x + jump_dx[dir], y + jump_dy[dir], g->width,
+                          g->height)) {
+          jump_line(g, x, y, dir);
+        }
+      }
+    }
+  }
+}
+
+// jump_prune of a straight direction, read from the jump table
+static int jump_straight(int end, int pos, unsigned char dir, struct map *m,
+                         int from) {
+  int w = m->width;
+  int x = pos % w, y = pos / w;
+  int dx = jump_dx[dir], dy = jump_dy[dir];
+  int entry = m->grid->jumps[pos * 8 + dir];
+  int reach = entry > 0 ? entry : -entry;
+  // The window cuts the line like a wall would
+  int room = dx > 0   ? m->max_x - x
+             : dx < 0 ? x - m->min_x
+             : dy > 0 ? m->max_y - y
+                      : y - m->min_y;
+  if (reach > room) {
+    reach = room;
+    entry = 0;
+  }
+  int ex = end % w - x, ey = end / w - y;
+  int steps = dx ? ex * dx : ey * dy;
+  if ((dx ? ey : ex) == 0 && steps > 0 && steps <= reach) {
+    put_in_open_set(m, end, from, dir);
+    return 1;
+  }
+  if (entry > 0) {
+    put_in_open_set(m, pos + entry * (dx + dy * w), from, dir);
+  }
+  return 0;
+}
+
+// jump_prune of corner avoiding paths, read from the jump table
+static int jump_table(int end, int pos, unsigned char dir, struct map *m,
+                      int from) {
+  if (!dir_is_diagonal(dir)) {
+    return jump_straight(end, pos, dir, m, from);
+  }
+  int w = m->width;
+  int x = pos % w, y = pos / w;
+  int dx = jump_dx[dir], dy = jump_dy[dir];
+  int steps = m->grid->jumps[pos * 8 + dir];
+  int room_x = dx > 0 ? m->max_x - x : x - m->min_x;
+  int room_y = dy > 0 ? m->max_y - y : y - m->min_y;
+  if (steps > room_x) {
+    steps = room_x;
+  }
+  if (steps > room_y) {
+    steps = room_y;
+  }
+  for (int i = 0; i < steps; i++) {
+    pos += dx + dy * w;
+    if (pos == end) {
+      put_in_open_set(m, pos, from, dir);
+      return 1;
+    }
+    if (jump_straight(end, pos, (dir + 7) % 8, m, from) == 1 ||
+        jump_straight(end, pos, (dir + 1) % 8, m, from) == 1) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static int new_component(struct jps_grid *g) {
+  if (g->component_count == g->component_capacity) {
+    g->component_capacity *= 2;
+    g->parent = (int *)realloc(g->parent, g->component_capacity * sizeof(int));
+  }
+  int label = g->component_count++;
+  g->parent[label] = label;
+  return label;
+}
+
+// Read only, searches of several threads may look components up at once
+static int find_component(struct jps_grid *g, int label) {
+  while (g->parent[label] != label) {
+    label = g->parent[label];
+  }
+  return label;
+}
+
+// Only called while obstacles change, so nobody else reads the labels
+static int compress_component(struct jps_grid *g, int label) {
+  int root = find_component(g, label);
+  while (g->parent[label] != root) {
+    int next = g->parent[label];
+    g->parent[label] = root;
+    label = next;
+  }
+  return root;
+}
+
+static int free_neighbours(struct jps_grid *g, int pos, int *out) {
+  int w = g->width, len = g->width * g->height;
+  int count = 0;
+  if (pos >= w && !BITTEST(g->m, pos - w)) {
+    out[count++] = pos - w;
+  }
+  if (pos % w != w - 1 && !BITTEST(g->m, pos + 1)) {
+    out[count++] = pos + 1;
+  }
+  if (pos < len - w && !BITTEST(g->m, pos + w)) {
+    out[count++] = pos + w;
+  }
+  if (pos % w != 0 && !BITTEST(g->m, pos - 1)) {
+    out[count++] = pos - 1;
+  }
+  return count;
+}
+
+static void flood_mark(struct jps_grid *g, int pos, int connected_num) {
+  int *queue = g->queue;
   int pop_i = 0, push_i = 0;
-  visited[pos] = 1;
-  m->connected[pos] = connected_num;
+  g->connected[pos] = connected_num;
   queue[push_i++] = pos;
 
-#define CHECK_POS(n)                                                           \
-  do {                                                                         \
-    if (!BITTEST(m->m, n)) {                                                   \
-      if (!visited[n]) {                                                       \
-        visited[n] = 1;                                                        \
-        m->connected[n] = connected_num;                                       \
-        queue[push_i++] = n;                                                   \
-      }                                                                        \
-    }                                                                          \
-  } while (0);
-  int cur, left;
+  int neighbours[4];
   while (pop_i < push_i) {
-    cur = queue[pop_i++];
-    left = cur % m->width;
-    if (left != 0) {
-      CHECK_POS(cur - 1);
-    }
-    if (left != m->width - 1) {
-      CHECK_POS(cur + 1);
+    int cur = queue[pop_i++];
+    int count = free_neighbours(g, cur, neighbours);
+    for (int n = 0; n < count; n++) {
+      if (!g->connected[neighbours[n]]) {
+        g->connected[neighbours[n]] = connected_num;
+        queue[push_i++] = neighbours[n];
+      }
     }
-    if (cur >= m->width) {
-      CHECK_POS(cur - m->width);
+  }
+}
+
+void jps_mark_connected(struct jps_grid *g) {
+  if (atomic_load_explicit(&g->mark_connected, memory_order_acquire)) {
+    return;
+  }
+  // Searches of several threads may get there at once, only one does the work
+  while (atomic_flag_test_and_set_explicit(&g->connected_lock,
+                                           memory_order_acquire)) {
+  }
+  if (!atomic_load_explicit(&g->mark_connected, memory_order_relaxed)) {
+    int len = g->width * g->height;
+    memset(g->connected, 0, len * sizeof(int));
+    // Label 0 is for obstacles
+    g->component_count = 1;
+    int i;
+    for (i = 0; i < len; i++) {
+      if (!g->connected[i] && !BITTEST(g->m, i)) {
+        flood_mark(g, i, new_component(g));
+      }
     }
-    if (cur < limit - m->width) {
-      CHECK_POS(cur + m->width);
+    atomic_store_explicit(&g->mark_connected, 1, memory_order_release);
+  }
+  atomic_flag_clear_explicit(&g->connected_lock, memory_order_release);
+}
+
+// `pos` became free, it joins and merges the components around it
+static void connect_cell(struct jps_grid *g, int pos) {
+  int neighbours[4];
+  int count = free_neighbours(g, pos, neighbours);
+  int root = 0;
+  for (int n = 0; n < count; n++) {
+    int r = compress_component(g, g->connected[neighbours[n]]);
+    if (!root) {
+      root = r;
+    } else if (r != root) {
+      g->parent[r] = root;
     }
   }
-#undef CHECK_POS
+  if (!root) {
+    root = new_component(g);
+  }
+  g->connected[pos] = root;
 }
 
-void jps_mark_connected(struct map *m) {
-  if (!m->mark_connected) {
-    m->mark_connected = 1;
-    int len = m->width * m->height;
-    memset(m->connected, 0, len * sizeof(int));
-    memset(m->visited, 0, len * sizeof(char));
-    int i, connected_num = 0;
-    for (i = 0; i < len; i++) {
-      if (!m->visited[i] && !BITTEST(m->m, i)) {
-        flood_mark(m, i, ++connected_num, len);
+static void push_split_queue(struct jps_grid *g, int group, int pos) {
+  if (g->split_count[group] == g->split_capacity[group]) {
+    g->split_capacity[group] = g->split_capacity[group] ? g->split_capacity[group] * 2 : 64;
+    g->split_queues[group] = (int *)realloc(
+        g->split_queues[group], g->split_capacity[group] * sizeof(int));
+  }
+  g->split_queues[group][g->split_count[group]++] = pos;
+}
+
+static int find_group(int *groups, int group) {
+  while (groups[group] != group) {
+    group = groups[group];
+  }
+  return group;
+}
+
+// `pos` became an obstacle, which may cut its component in several pieces. A
+// flood starts from each side of the new obstacle, one step at a time each.
+// Floods meeting each other are on the same piece. A piece whose floods end
+// before the others is cut off, and gets a new label. Only the smaller pieces
+// are visited, the largest keeps its label.
+static void disconnect_cell(struct jps_grid *g, int pos) {
+  int w = g->width, h = g->height;
+  int x = pos % w, y = pos / w;
+  g->connected[pos] = 0;
+
+  int neighbours[4];
+  int count = free_neighbours(g, pos, neighbours);
+  if (count <= 1) {
+    return;
+  }
+
+  // Neighbours joined by a free corner around the obstacle are obviously still
+  // connected
+  int groups[4];
+  for (int n = 0; n < count; n++) {
+    groups[n] = n;
+  }
+  for (int a = 0; a < count; a++) {
+    for (int b = a + 1; b < count; b++) {
+      int ax = neighbours[a] % w, ay = neighbours[a] / w;
+      int bx = neighbours[b] % w, by = neighbours[b] / w;
+      if (ax == bx || ay == by) {
+        continue;
+      }
+      int cx = ax == x ? bx : ax;
+      int cy = ay == y ? by : ay;
+      if (check_in_map(cx, cy, w, h) && !BITTEST(g->m, cx + cy * w)) {
+        groups[find_group(groups, b)] = find_group(groups, a);
+      }
+    }
+  }
+  int pieces = 0;
+  for (int n = 0; n < count; n++) {
+    pieces += groups[n] == n;
+  }
+  if (pieces == 1) {
+    return;
+  }
+
+  // Marks of this cut are base + flood, older ones are below base
+  if (g->split_epoch > UINT_MAX - 8) {
+    memset(g->split_marks, 0, w * h * sizeof(unsigned));
+    g->split_epoch = 0;
+  }
+  unsigned base = (g->split_epoch += 4);
+
+  for (int n = 0; n < 4; n++) {
+    g->split_count[n] = 0;
+  }
+  for (int n = 0; n < count; n++) {
+    int flood = find_group(groups, n);
+    g->split_marks[neighbours[n]] = base + flood;
+    push_split_queue(g, flood, neighbours[n]);
+  }
+
+  int heads[4] = {0};
+  int done[4] = {0};
+  int around[4];
+  for (;;) {
+    for (int f = 0; f < count; f++) {
+      if (heads[f] >= g->split_count[f]) {
+        continue;
+      }
+      int cur = g->split_queues[f][heads[f]++];
+      int around_count = free_neighbours(g, cur, around);
+      for (int n = 0; n < around_count; n++) {
+        int next = around[n];
+        if (g->split_marks[next] < base) {
+          g->split_marks[next] = base + f;
+          push_split_queue(g, f, next);
+        } else {
+          int a = find_group(groups, f);
+          int b = find_group(groups, g->split_marks[next] - base);
+          if (a != b) {
+            groups[b] = a;
+            pieces--;
+            if (pieces == 1) {
+              return;
+            }
+          }
+        }
+      }
+    }
+
+    // Pieces with nothing left to flood are cut off from the others
+    for (int p = 0; p < count; p++) {
+      if (groups[p] != p || done[p]) {
+        continue;
+      }
+      int exhausted = 1;
+      for (int f = 0; f < count; f++) {
+        if (find_group(groups, f) == p && heads[f] < g->split_count[f]) {
+          exhausted = 0;
+        }
+      }
+      if (!exhausted) {
+        continue;
+      }
+
+      int label = new_component(g);
+      for (int f = 0; f < count; f++) {
+        if (find_group(groups, f) != p) {
+          continue;
+        }
+        for (int c = 0; c < g->split_count[f]; c++) {
+          g->connected[g->split_queues[f][c]] = label;
+        }
+      }
+      done[p] = 1;
+      pieces--;
+      if (pieces == 1) {
+        return;
       }
     }
   }
 }
 
+int jps_component(struct jps_grid *g, int x, int y) {
+  if (!check_in_map(x, y, g->width, g->height)) {
+    return 0;
+  }
+  jps_mark_connected(g);
+  int label = g->connected[x + y * g->width];
+  return label ? find_component(g, label) : 0;
+}
+
+int jps_is_reachable(struct jps_grid *g, int x0, int y0, int x1, int y1) {
+  int a = jps_component(g, x0, y0);
+  return a != 0 && a == jps_component(g, x1, y1);
+}
+
 static int compare(int a, int b, void *il) {
   il = (IntList *)il;
   int af = il_get(il, a, NODE_F);
@@ -513,10 +1008,11 @@ static int compare(int a, int b, void *il) {
 }
 
 int jps_path_finding(struct map *m, int type, IntList *out) {
-  if (BITTEST(m->m, m->start)) {
+  m->expanded = 0;
+  if (OBSTACLE(m, m->start)) {
     return 1;
   }
-  if (BITTEST(m->m, m->end)) {
+  if (OBSTACLE(m, m->end)) {
     return 2;
   }
   if (m->start == m->end) {
@@ -526,29 +1022,32 @@ int jps_path_finding(struct map *m, int type, IntList *out) {
     return 3;
   }
   m->path_type = type;
-  if (!m->mark_connected) {
-    jps_mark_connected(m);
-  }
-  if (m->connected[m->start] != m->connected[m->end]) {
+  jps_mark_connected(m->grid);
+  if (find_component(m->grid, m->grid->connected[m->start]) !=
+      find_component(m->grid, m->grid->connected[m->end])) {
     return 4;
   }
 
-  int len = m->width * m->height;
-  // closeset clear
-  memset(&m->m[BITSLOT(len) + 1], 0, (BITSLOT(len) + 1) * sizeof(m->m[0]));
-  memset(m->comefrom, -1, len * sizeof(int));
-  memset(m->open_set_map, -1, len * sizeof(int));
+  // Forget the previous search by moving to the next generation, only clear
+  // the stamps when it wraps around
+  m->generation++;
+  if (m->generation == 0) {
+    memset(m->nodes, 0, m->width * m->height * sizeof(struct jps_node));
+    m->generation = 1;
+  }
   il_clear(m->il);
   heap_init(m->h, compare, m->il);
   heap_clear(m->h);
 
+  touch(m, m->start);
   add_to_openset(m, m->start, 0, NO_DIRECTION);
+  int table = m->grid->jumps && type == OBS_CONNER_AVOID;
   int cur, cpos, cdir;
   unsigned char check_dirs, dir;
   while ((cur = heap_pop(m->h)) >= 0) {
+    m->expanded++;
     cpos = il_get(m->il, cur, NODE_POS);
-    m->open_set_map[cpos] = -1;
-    BITSET(m->m, (BITSLOT(len) + 1) * CHAR_BIT + cpos);
+    m->nodes[cpos].open_set = NODE_CLOSED;
     if (cpos == m->end) {
       form_path(cpos, m, out);
       return 0;
@@ -557,7 +1056,9 @@ int jps_path_finding(struct map *m, int type, IntList *out) {
     check_dirs = natural_dir(cpos, cdir, m) | force_dir(cpos, cdir, m);
     dir = next_dir(&check_dirs);
     while (dir != NO_DIRECTION) {
-      if (jump_prune(m->end, cpos, dir, m, cur) == 1) { // found end
+      int found = table ? jump_table(m->end, cpos, dir, m, cur)
+                        : jump_prune(m->end, cpos, dir, m, cur);
+      if (found == 1) { // found end
         break;
       }
       dir = next_dir(&check_dirs);
@@ -566,7 +1067,7 @@ int jps_path_finding(struct map *m, int type, IntList *out) {
   return 4;
 }
 
-void jps_dump_connected(struct map *m) {
+void jps_dump_connected(struct jps_grid *m) {
 #ifdef DEBUG
   print("dump map connected state!!!!!!\n");
   if (!m->mark_connected) {
@@ -592,7 +1093,6 @@ void jps_dump(struct map *m) {
 #ifdef DEBUG
   print("dump map state!!!!!!\n");
   int i, pos;
-  int len = m->width * m->height;
   char s[m->width * 2 + 2];
   for (pos = 0, i = 0; i < m->width * m->height; i++) {
     if (i > 0 && i % m->width == 0) {
@@ -601,11 +1101,11 @@ void jps_dump(struct map *m) {
       pos = 0;
     }
     int mark = 0;
-    if (BITTEST(m->m, i)) {
+    if (OBSTACLE(m, i)) {
       s[pos++] = '*';
       mark = 1;
     } else {
-      if (BITTEST(m->m, (BITSLOT(len) + 1) * 2 * CHAR_BIT + i)) {
+      if (BITTEST(m->m, i)) {
         s[pos++] = '0';
         mark = 1;
       }
@@ -630,40 +1130,76 @@ void jps_dump(struct map *m) {
 #endif // DEBUG
 }
 
-struct map *jps_create(int w, int h) {
+struct jps_grid *jps_grid_create(int w, int h) {
   assert(w > 0 && h > 0);
   int len = w * h;
+  int bits_len = BITSLOT(len) + 1;
+  struct jps_grid *g = (struct jps_grid *)malloc(sizeof(struct jps_grid) +
+                                                 bits_len * sizeof(g->m[0]));
+  g->width = w;
+  g->height = h;
+  g->revision = 0;
+  atomic_init(&g->mark_connected, 0);
+  atomic_flag_clear(&g->connected_lock);
+  g->connected = (int *)malloc(len * sizeof(int));
+  g->queue = (int *)malloc(len * sizeof(int));
+  g->component_capacity = 64;
+  g->component_count = 1;
+  g->parent = (int *)malloc(g->component_capacity * sizeof(int));
+  g->parent[0] = 0;
+  g->split_marks = (unsigned *)calloc(len, sizeof(unsigned));
+  g->split_epoch = 0;
+  memset(g->split_queues, 0, sizeof(g->split_queues));
+  memset(g->split_count, 0, sizeof(g->split_count));
+  memset(g->split_capacity, 0, sizeof(g->split_capacity));
+  g->jumps = NULL;
+  g->row_words = (w + 63) / 64;
+  g->column_words = (h + 63) / 64;
+  g->rows = (uint64_t *)calloc(h * g->row_words, sizeof(uint64_t));
+  g->columns = (uint64_t *)calloc(w * g->column_words, sizeof(uint64_t));
+  memset(g->m, 0, bits_len * sizeof(g->m[0]));
+  return g;
+}
+
+void jps_grid_destroy(struct jps_grid *g) {
+  free(g->connected);
+  free(g->queue);
+  free(g->parent);
+  free(g->split_marks);
+  for (int i = 0; i < 4; i++) {
+    free(g->split_queues[i]);
+  }
+  free(g->jumps);
+  free(g->rows);
+  free(g->columns);
+
+  free(g);
+}
+
+struct map *jps_create(struct jps_grid *grid) {
+  int len = grid->width * grid->height;
   int map_men_len = jps_get_memory_len(len);
   struct map *m =
       (struct map *)malloc(sizeof(struct map) + map_men_len * sizeof(m->m[0]));
-  jps_init(m, w, h, map_men_len);
-  return m;
-}
-
-void jps_init(struct map *m, int w, int h, int map_men_len) {
-  int len = w * h;
-  m->width = w;
-  m->height = h;
+  m->grid = grid;
+  m->width = grid->width;
+  m->height = grid->height;
   m->start = -1;
   m->end = -1;
-  m->mark_connected = 0;
-  m->comefrom = (int *)malloc(len * sizeof(int));
-  m->connected = (int *)malloc(len * sizeof(int));
-  m->queue = (int *)malloc(len * sizeof(int));
-  m->visited = (char *)malloc(len * sizeof(char));
-  m->open_set_map = (int *)malloc(len * sizeof(int));
+  // Generation 0 is never used by a search, every node starts stale
+  m->nodes = (struct jps_node *)calloc(len, sizeof(struct jps_node));
+  m->generation = 0;
   m->il = il_create(NODE_SIZE);
   m->h = heap_new();
   m->path_type = OBS_CONNER_OK;
+  m->expanded = 0;
+  jps_set_window(m, 0, 0, m->width - 1, m->height - 1);
   memset(m->m, 0, map_men_len * sizeof(m->m[0]));
+  return m;
 }
 
 void jps_destroy(struct map *m) {
-  free(m->comefrom);
-  free(m->connected);
-  free(m->queue);
-  free(m->visited);
-  free(m->open_set_map);
+  free(m->nodes);
   il_destroy(m->il);
   heap_free(m->h);
 
@@ -1,47 +1,120 @@
 #ifndef __JPS__
 #define __JPS__
 
+#include <stdatomic.h>
+#include <stdint.h>
+
 #include "heap.h"
 #include "intlist.h"
 
-struct map {
+// Obstacles of a map, shared by every search context made from it. Obstacles
+// must not change while a search runs.
+struct jps_grid {
   int width;
   int height;
-  int start;
-  int end;
-  int *comefrom;
+  // Bumped every time an obstacle is added or removed
+  unsigned revision;
 
-  //  for mark connected
-  char mark_connected;
+  //  for mark connected, done once by the first search, then kept up to date
+  //  by jps_set_obstacle. Cells hold a label, labels merged together point to
+  //  the same parent.
+  atomic_char mark_connected;
+  atomic_flag connected_lock;
   int *connected;
   int *queue;
-  char *visited;
+  int *parent;
+  int component_count;
+  int component_capacity;
+
+  // Floods started when an obstacle may cut a component
+  unsigned *split_marks;
+  unsigned split_epoch;
+  int *split_queues[4];
+  int split_count[4];
+  int split_capacity[4];
+
+  // JPS+ table, see jps_build_jump_table. 8 entries per cell, one by
+  // direction: straight ones are the steps to the next forced jump point, or
+  // minus the free steps before a wall, diagonal ones the free steps before a
+  // wall. Kept up to date by jps_set_obstacle, NULL until built.
+  short *jumps;
+
+  // The obstacles again, 64 tiles a word for the straight jumps: rows padded
+  // to whole words, and columns, the map transposed
+  uint64_t *rows;
+  uint64_t *columns;
+  int row_words;
+  int column_words;
+
+  /*
+      [map]
+  */
+  char m[1];
+};
+
+// Search state of a cell, only meaningful when stamped with the generation of
+// the running search
+struct jps_node {
+  unsigned generation;
+  int comefrom;
+  // Index in the open set, or unseen / closed
+  int open_set;
+};
 
-  int *open_set_map;
+// Scratch of a single search, one per thread searching the grid
+struct map {
+  struct jps_grid *grid;
+  int width;
+  int height;
+  int start;
+  int end;
+
+  // Bumped by every search instead of clearing the nodes
+  unsigned generation;
+  struct jps_node *nodes;
   IntList *il;
   heap_t *h;
 
   int path_type;
+  // Searches don't leave the rectangle, the whole map by default
+  int min_x;
+  int min_y;
+  int max_x;
+  int max_y;
+  // Nodes popped from the open set by the last jps_path_finding
+  int expanded;
   /*
-      [map] | [close_set] | [path]
+      [path], only with DEBUG
   */
   char m[1];
 };
 
-struct map *jps_create(int w, int h);
-void jps_init(struct map *m, int w, int h, int map_men_len);
+struct jps_grid *jps_grid_create(int w, int h);
+void jps_grid_destroy(struct jps_grid *g);
+
+int jps_set_obstacle(struct jps_grid *g, int x, int y, int bit);
+int jps_is_obstacle(struct jps_grid *g, int x, int y);
+void jps_clearall_obs(struct jps_grid *g);
+// Precompute the jumps of every cell, corner avoiding searches read them
+// instead of scanning the map from then on
+void jps_build_jump_table(struct jps_grid *g);
+void jps_mark_connected(struct jps_grid *g);
+// Id of the area of the cell, 0 for obstacles. Ids may change when obstacles
+// do, only compare ids taken in between.
+int jps_component(struct jps_grid *g, int x, int y);
+int jps_is_reachable(struct jps_grid *g, int x0, int y0, int x1, int y1);
+
+struct map *jps_create(struct jps_grid *grid);
 void jps_destroy(struct map *m);
 int jps_get_memory_len(int len);
 
-int jps_set_obstacle(struct map *m, int x, int y, int bit);
-int jps_is_obstacle(struct map *m, int x, int y);
-void jps_clearall_obs(struct map *m);
 int jps_set_start(struct map *m, int x, int y);
 int jps_set_end(struct map *m, int x, int y);
-void jps_mark_connected(struct map *m);
+// Keep the searches within [x0, x1] and [y0, y1], out of it is like walls
+void jps_set_window(struct map *m, int x0, int y0, int x1, int y1);
 int jps_path_finding(struct map *m, int type, IntList *path);
 
-void jps_dump_connected(struct map *m);
+void jps_dump_connected(struct jps_grid *g);
 void jps_dump(struct map *m);
 
 #endif // __JPS__
@@ -119,6 +119,9 @@ void qcvm_set_user_data(qcvm_t* qcvm, void* user_data);
 
 void* qcvm_get_user_data(qcvm_t* qcvm);
 
+/* number of statements executed since the vm was created */
+unsigned long qcvm_get_executed(qcvm_t* qcvm);
+
 /*
  * qcvm_entities.c
  */
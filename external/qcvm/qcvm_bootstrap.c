@@ -257,3 +257,8 @@ void* qcvm_get_user_data(qcvm_t* qcvm)
 {
 	return qcvm->user_data;
 }
+
+unsigned long qcvm_get_executed(qcvm_t* qcvm)
+{
+	return qcvm->executed;
+}
@@ -312,6 +312,9 @@ struct qcvm_runtime
 
 	void* user_data;
 
+	/* statements executed since the vm was created */
+	unsigned long executed;
+
 	/* runtime */
 	qcvm_evaluator_t *eval_p[4];
 	int exit_depth;
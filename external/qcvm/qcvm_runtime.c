@@ -172,6 +172,7 @@ void qcvm_run(qcvm_t *qcvm, int func)
 
 		/* update stack */
 		qcvm->xstack.function->profile++;
+		qcvm->executed++;
 		qcvm->xstack.statement = qcvm->statement_i;
 
 		/* check opcode validity */
@@ -34,6 +34,8 @@ struct client_t {
   unsigned screen_width, screen_height;
   unsigned view_width, view_height;
 
+  unsigned worker_cap;
+
   vk_rend_t *rend;
 
   input_t input;
@@ -145,6 +147,22 @@ bool CL_ParseClientDesc(client_desc_t *desc, int argc, char *argv[]) {
         printf("Only Scripting is either 'true' or 'false'.\n");
         is_error = true;
       }
+    } else if (!strcmp(arg, "--workers") || !strcmp(arg, "-j")) {
+      if (i + 1 >= argc) {
+        printf("Missing a number after '--workers' or '-j'.\n");
+        is_error = true;
+        break;
+      }
+      char *workers = argv[i + 1];
+      char *endptr;
+      unsigned val = strtol(workers, &endptr, 10);
+
+      if ((endptr - workers) == 0 || (endptr - workers) != (long)strlen(workers)) {
+        printf("Couldn't parse '--workers' argument value '%s'.\n", workers);
+        is_error = true;
+      } else {
+        desc->workers = val;
+      }
     }
   }
 
@@ -184,6 +202,11 @@ void CL_CompleteClientDesc(client_t *client, client_desc_t *desc) {
     zpl_u64 key = zpl_fnv64("video$fullscreen", strlen("video$fullscreen"));
     IF_NULL(int, desc->fullscreen, CL_Integers_get(&client->global_variable_ints, key), 0)
   }
+
+  if (desc->workers == 0) {
+    zpl_u64 key = zpl_fnv64("engine$workers", strlen("engine$workers"));
+    IF_NULL(int, desc->workers, CL_Integers_get(&client->global_variable_ints, key), 0)
+  }
 }
 
 client_t *CL_CreateClient(const char *title, client_desc_t *desc) {
@@ -231,6 +254,7 @@ client_t *CL_CreateClient(const char *title, client_desc_t *desc) {
   client->state = CLIENT_RUNNING;
   client->window = window;
 
+  client->worker_cap = desc->workers;
   client->view_width = desc->width;
   client->screen_width = screen_width;
   client->view_height = desc->height;
@@ -278,6 +302,8 @@ void CL_GetScreenDim(client_t *client, unsigned *width, unsigned *height) {
   *height = client->screen_height;
 }
 
+unsigned CL_GetWorkerCap(client_t *client) { return client->worker_cap; }
+
 void CL_UpdateClient(client_t *client) {
   SDL_Event event;
 
@@ -21,6 +21,7 @@ typedef struct client_desc_t {
   unsigned framerate;
   unsigned fullscreen;
   unsigned only_scripting;
+  unsigned workers; // 0 means one per hardware thread
 } client_desc_t;
 
 typedef enum client_state_t {
@@ -46,6 +47,7 @@ void CL_SetClientState(client_t *client, client_state_t state);
 vk_rend_t *CL_GetRend(client_t *client);
 void CL_GetViewDim(client_t *client, unsigned *width, unsigned *height);
 void CL_GetScreenDim(client_t *client, unsigned *width, unsigned *height);
+unsigned CL_GetWorkerCap(client_t *client);
 
 void CL_UpdateClient(client_t *client);
 
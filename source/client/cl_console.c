@@ -1,6 +1,7 @@
 #include "cglm/types.h"
 #include "client/cl_client.h"
 #include "client/cl_input.h"
+#include "common/c_profiler.h"
 #include "game/g_game.h"
 #include "vk/vk_vulkan.h"
 
@@ -69,6 +70,90 @@ bool CL_ExitConsole(client_console_t *console, void *user_data,
   }
 }
 
+bool CL_DumpTraceConsole(client_console_t *console, void *user_data,
+                         wchar_t args[64][64], unsigned count) {
+  static wchar_t output[256];
+
+  if (count > 1) {
+    console->output = L"CL_DumpTraceConsole accepts at most one argument: the file name.";
+
+    return false;
+  }
+
+  char path[128] = "trace.json";
+  if (count == 1) {
+    wcstombs(path, args[1], sizeof(path) - 1);
+  }
+
+  if (!C_ProfilerDumpTrace(path)) {
+    console->output = L"Couldn't dump the trace.";
+
+    return false;
+  }
+
+  swprintf(output, 256, L"Trace written to %s.", path);
+  console->output = output;
+
+  return true;
+}
+
+bool CL_DumpCountersConsole(client_console_t *console, void *user_data,
+                            wchar_t args[64][64], unsigned count) {
+  static wchar_t output[256];
+
+  if (count > 1) {
+    console->output = L"CL_DumpCountersConsole accepts at most one argument: the file name.";
+
+    return false;
+  }
+
+  char path[128] = "counters.csv";
+  if (count == 1) {
+    wcstombs(path, args[1], sizeof(path) - 1);
+  }
+
+  if (!C_ProfilerDumpCounters(path)) {
+    console->output = L"Couldn't dump the counters.";
+
+    return false;
+  }
+
+  swprintf(output, 256, L"Counters written to %s.", path);
+  console->output = output;
+
+  return true;
+}
+
+bool CL_TraceThresholdConsole(client_console_t *console, void *user_data,
+                              wchar_t args[64][64], unsigned count) {
+  static wchar_t output[256];
+
+  if (count != 1) {
+    console->output = L"CL_TraceThresholdConsole expects a frame time in milliseconds, 0 to disable.";
+
+    return false;
+  }
+
+  wchar_t *endptr;
+  double ms = wcstod(args[1], &endptr);
+  if (endptr == args[1] || ms < 0.0) {
+    console->output = L"The frame time should be a positive number.";
+
+    return false;
+  }
+
+  C_ProfilerSetTraceThreshold(ms);
+
+  if (ms == 0.0) {
+    console->output = L"Slow frames aren't dumped anymore.";
+  } else {
+    swprintf(output, 256, L"Frames slower than %.2fms will be dumped.", ms);
+    console->output = output;
+  }
+
+  return true;
+}
+
 bool CL_InitConsole(client_t *client, client_console_t **c) {
   (*c) = calloc(1, sizeof(client_console_t));
   client_console_t *console = *c;
@@ -91,8 +176,24 @@ bool CL_InitConsole(client_t *client, client_console_t **c) {
       .user_data = client,
   };
 
+  cmd_desc_t trace_dump_command = {
+      .command = L"trace_dump",
+      .callback = CL_DumpTraceConsole,
+  };
+  cmd_desc_t counters_dump_command = {
+      .command = L"counters_dump",
+      .callback = CL_DumpCountersConsole,
+  };
+  cmd_desc_t trace_threshold_command = {
+      .command = L"trace_threshold",
+      .callback = CL_TraceThresholdConsole,
+  };
+
   CL_ExportCommandConsole(console, &version_command);
   CL_ExportCommandConsole(console, &exit_command);
+  CL_ExportCommandConsole(console, &trace_dump_command);
+  CL_ExportCommandConsole(console, &trace_threshold_command);
+  CL_ExportCommandConsole(console, &counters_dump_command);
 
   return true;
 }
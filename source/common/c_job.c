@@ -1,81 +1,507 @@
 #include <common/c_job.h>
+#include <common/c_profiler.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <zpl/zpl.h>
 #include <common/c_terminal.h>
 
-ZPL_RING_DECLARE(extern, jobs_ring_, job_t);
-ZPL_RING_DEFINE(jobs_ring_, job_t);
+typedef struct graph_node_t graph_node_t;
+
+typedef struct parallel_for_t {
+  jobs_range_proc_t proc;
+  void *data;
+  unsigned grain;
+
+  // Items of the range that haven't been processed yet
+  job_counter_t remaining;
+
+  // Set when the parallel for is a node of a graph, the node is completed once
+  // the last item is processed
+  graph_node_t *node;
+} parallel_for_t;
+
+// What actually lives in the queues: either a plain job, or a chunk of a
+// parallel for.
+typedef struct task_t {
+  job_t job;
+
+  parallel_for_t *range;
+  unsigned begin;
+  unsigned end;
+
+  // Set on the task that starts a graph node
+  graph_node_t *node;
+} task_t;
+
+typedef struct graph_node_t {
+  job_graph_t *graph;
+
+  // Either `job` or `range` is used
+  job_t job;
+  parallel_for_t range;
+  unsigned begin;
+  unsigned end;
+
+  unsigned reads;
+  unsigned writes;
+
+  // One bit per node that has to wait for this one
+  uint64_t successors;
+  unsigned dependency_count;
+  atomic_uint dependencies;
+
+  double start;
+  double end_time;
+} graph_node_t;
+
+typedef struct job_graph_t {
+  job_system_t *sys;
+
+  graph_node_t nodes[JOB_GRAPH_MAX_NODES];
+  unsigned node_count;
+
+  // Nodes that haven't completed yet
+  job_counter_t remaining;
+} job_graph_t;
+
+ZPL_RING_DECLARE(extern, tasks_ring_, task_t);
+ZPL_RING_DEFINE(tasks_ring_, task_t);
+
+// Has to be a power of two
+#define DEQUE_CAPACITY 4096
+// How many times a thread looks for work before going to sleep
+#define SPIN_COUNT 64
+// When no grain is given, aim for that many chunks per thread
+#define CHUNKS_PER_THREAD 8
+
+// A locked FIFO, for threads that don't own a deque and for background jobs
+typedef struct job_queue_t {
+  zpl_mutex mutex;
+  tasks_ring_task_t ring;
+  atomic_uint count;
+} job_queue_t;
+
+// Chase-Lev work-stealing deque. Its owner pushes and pops jobs at the bottom
+// without taking any lock, while every other thread steals from the top.
+typedef struct job_deque_t {
+  _Alignas(64) atomic_long top;
+  _Alignas(64) atomic_long bottom;
+  task_t *buffer;
+} job_deque_t;
 
 typedef struct thread_data_t {
   unsigned idx;
+  unsigned seed;
   job_system_t *sys;
 
-  enum {
-    THREAD_BUSY,
-    THREAD_WAIT,
-  } state;
-} thread_data_t;
+  job_deque_t deque;
+} __attribute__((aligned(64))) thread_data_t;
 
 typedef struct job_system_t {
-  zpl_semaphore job_count;
-  zpl_atomic32 job_count_value;
+  // One slot per worker, plus a last one for the thread that created the job
+  // system (so the main thread can push without locking as well)
+  thread_data_t *data;
+  zpl_thread *threads;
+
+  // Jobs submitted by threads that don't own a deque, or when a deque is full
+  job_queue_t injection;
+
+  // Background jobs never go through the deques, so a thread looking for
+  // critical work never has to skip over them
+  job_queue_t background;
+  atomic_uint background_running;
+  unsigned max_background_running;
+
+  zpl_semaphore wake;
+  atomic_int sleepers;
+
+  // Threads parked in C_JobSystemWait until some counter reaches zero. Each
+  // one sleeps on its own semaphore, a shared one would let a waiter take the
+  // wake-up meant for another.
+  zpl_mutex waiter_lock;
+  struct job_waiter_t *waiter_list;
+  atomic_int waiters;
+
+  // Enqueued jobs that haven't finished running yet
+  atomic_int pending;
+
+  atomic_bool exiting;
+  unsigned thread_count;
+} job_system_t;
 
-  zpl_mutex job_mutex;
+typedef struct job_waiter_t {
+  zpl_semaphore wake;
+  struct job_waiter_t *next;
+} job_waiter_t;
 
-  jobs_ring_job_t jobs;
-  zpl_thread threads[32];
-  thread_data_t data[32];
+static _Thread_local thread_data_t *Current_Thread_Data = NULL;
 
-  unsigned exiting;
-  unsigned thread_count;
-} job_system_t;
+static void C_DequeInit(job_deque_t *deque) {
+  atomic_store(&deque->top, 0);
+  atomic_store(&deque->bottom, 0);
+  deque->buffer = calloc(DEQUE_CAPACITY, sizeof(task_t));
+}
+
+static bool C_DequePush(job_deque_t *deque, task_t task) {
+  long b = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+  long t = atomic_load_explicit(&deque->top, memory_order_acquire);
+
+  if (b - t > DEQUE_CAPACITY - 1) {
+    return false;
+  }
+
+  deque->buffer[b & (DEQUE_CAPACITY - 1)] = task;
+  atomic_store_explicit(&deque->bottom, b + 1, memory_order_release);
+
+  return true;
+}
+
+static bool C_DequePop(job_deque_t *deque, task_t *task) {
+  long b = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+  atomic_store_explicit(&deque->bottom, b, memory_order_relaxed);
+  atomic_thread_fence(memory_order_seq_cst);
+  long t = atomic_load_explicit(&deque->top, memory_order_relaxed);
+
+  if (t > b) {
+    // Empty
+    atomic_store_explicit(&deque->bottom, b + 1, memory_order_relaxed);
+    return false;
+  }
+
+  *task = deque->buffer[b & (DEQUE_CAPACITY - 1)];
+
+  if (t == b) {
+    // Last job, race against the thieves
+    bool won = atomic_compare_exchange_strong_explicit(
+        &deque->top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed);
+    atomic_store_explicit(&deque->bottom, b + 1, memory_order_relaxed);
+    return won;
+  }
+
+  return true;
+}
+
+static bool C_DequeSteal(job_deque_t *deque, task_t *task) {
+  long t = atomic_load_explicit(&deque->top, memory_order_acquire);
+  atomic_thread_fence(memory_order_seq_cst);
+  long b = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+
+  if (t >= b) {
+    return false;
+  }
+
+  // The owner may be overwriting this slot, the copy is only kept if the CAS
+  // below proves nobody touched the top in the meantime
+  *task = deque->buffer[t & (DEQUE_CAPACITY - 1)];
+
+  return atomic_compare_exchange_strong_explicit(
+      &deque->top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed);
+}
+
+static long C_DequeSize(job_deque_t *deque) {
+  long b = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+  long t = atomic_load_explicit(&deque->top, memory_order_relaxed);
+  return b - t;
+}
+
+static void C_QueueInit(job_queue_t *queue) {
+  zpl_mutex_init(&queue->mutex);
+  tasks_ring_init(&queue->ring, zpl_heap_allocator(), 1024);
+  atomic_store(&queue->count, 0);
+}
+
+static void C_QueueDestroy(job_queue_t *queue) {
+  tasks_ring_free(&queue->ring);
+  zpl_mutex_destroy(&queue->mutex);
+}
+
+static void C_QueuePush(job_queue_t *queue, task_t task) {
+  zpl_mutex_lock(&queue->mutex);
+  if (tasks_ring_full(&queue->ring)) {
+    // The ring silently overwrites its oldest entry when full, grow it instead
+    tasks_ring_task_t bigger;
+    tasks_ring_init(&bigger, zpl_heap_allocator(), (queue->ring.capacity - 1) * 2);
+    task_t *old;
+    while ((old = tasks_ring_get(&queue->ring))) {
+      tasks_ring_append(&bigger, *old);
+    }
+    tasks_ring_free(&queue->ring);
+    queue->ring = bigger;
+  }
+  tasks_ring_append(&queue->ring, task);
+  atomic_fetch_add(&queue->count, 1);
+  zpl_mutex_unlock(&queue->mutex);
+}
+
+static bool C_QueuePop(job_queue_t *queue, task_t *task) {
+  // Don't touch the mutex if there's obviously nothing to take
+  if (atomic_load_explicit(&queue->count, memory_order_relaxed) == 0) {
+    return false;
+  }
+
+  bool found = false;
+  zpl_mutex_lock(&queue->mutex);
+  task_t *the_task = tasks_ring_get(&queue->ring);
+  if (the_task) {
+    *task = *the_task;
+    atomic_fetch_sub(&queue->count, 1);
+    found = true;
+  }
+  zpl_mutex_unlock(&queue->mutex);
+
+  return found;
+}
+
+// Background jobs are capped, so some workers always stay available for the
+// next frame, even when a long load is going on
+static bool C_BackgroundPop(job_system_t *sys, task_t *task) {
+  if (atomic_load_explicit(&sys->background.count, memory_order_relaxed) == 0) {
+    return false;
+  }
+
+  unsigned running = atomic_load(&sys->background_running);
+  do {
+    if (running >= sys->max_background_running) {
+      return false;
+    }
+  } while (!atomic_compare_exchange_weak(&sys->background_running, &running, running + 1));
+
+  if (!C_QueuePop(&sys->background, task)) {
+    atomic_fetch_sub(&sys->background_running, 1);
+    return false;
+  }
+
+  return true;
+}
+
+// Look for a job: own deque first, then steal from the others starting at a
+// random victim, then the injection queue. Background jobs come last, and only
+// when the caller allows it.
+static bool C_JobSystemFindTask(job_system_t *sys, thread_data_t *self,
+                                task_t *task, bool allow_background) {
+  if (self && C_DequePop(&self->deque, task)) {
+    return true;
+  }
+
+  unsigned slot_count = sys->thread_count + 1;
+  unsigned start = 0;
+  if (self) {
+    self->seed = self->seed * 1103515245 + 12345;
+    start = (self->seed >> 16) % slot_count;
+  }
+
+  for (unsigned i = 0; i < slot_count; i++) {
+    thread_data_t *victim = &sys->data[(start + i) % slot_count];
+    if (victim != self && C_DequeSteal(&victim->deque, task)) {
+      return true;
+    }
+  }
+
+  if (C_QueuePop(&sys->injection, task)) {
+    return true;
+  }
+
+  return allow_background && C_BackgroundPop(sys, task);
+}
+
+static void C_JobSystemWakeOne(job_system_t *sys) {
+  int sleepers = atomic_load(&sys->sleepers);
+  while (sleepers > 0) {
+    if (atomic_compare_exchange_weak(&sys->sleepers, &sleepers, sleepers - 1)) {
+      zpl_semaphore_post(&sys->wake, 1);
+      return;
+    }
+  }
+}
+
+// Return true when the counter reached zero
+static bool C_JobCounterSub(job_system_t *sys, job_counter_t *counter,
+                            unsigned amount) {
+  if (atomic_fetch_sub(&counter->value, amount) != amount) {
+    return false;
+  }
+
+  // Counters aren't tied to a waiter, wake everybody up and let them check
+  // their own
+  if (atomic_load(&sys->waiters) > 0) {
+    zpl_mutex_lock(&sys->waiter_lock);
+    for (job_waiter_t *waiter = sys->waiter_list; waiter;) {
+      job_waiter_t *next = waiter->next;
+      zpl_semaphore_post(&waiter->wake, 1);
+      waiter = next;
+    }
+    sys->waiter_list = NULL;
+    atomic_store(&sys->waiters, 0);
+    zpl_mutex_unlock(&sys->waiter_lock);
+  }
+
+  return true;
+}
+
+static void C_JobGraphComplete(graph_node_t *node);
+
+static void C_JobSystemPush(job_system_t *sys, task_t task) {
+  atomic_fetch_add_explicit(&sys->pending, 1, memory_order_relaxed);
+  if (task.job.counter) {
+    atomic_fetch_add(&task.job.counter->value, 1);
+  }
+
+  thread_data_t *self = Current_Thread_Data;
+  if (!task.range && task.job.priority == JOB_PRIORITY_BACKGROUND) {
+    C_QueuePush(&sys->background, task);
+  } else if (!self || self->sys != sys || !C_DequePush(&self->deque, task)) {
+    C_QueuePush(&sys->injection, task);
+  }
+
+  // Pairs with the sleepers increment in C_JobEntryPoint
+  atomic_thread_fence(memory_order_seq_cst);
+  C_JobSystemWakeOne(sys);
+}
+
+// Process a chunk of a parallel for. As long as our own deque is empty, the
+// upper half of the remaining range is pushed for others to steal, so chunks
+// only get smaller when some threads are actually starving (lazy binary
+// splitting). Otherwise the range is walked `grain` items at a time.
+static void C_JobSystemRunRange(job_system_t *sys, thread_data_t *self,
+                                task_t *task, unsigned thread_idx) {
+  parallel_for_t *range = task->range;
+  graph_node_t *node = range->node;
+  unsigned begin = task->begin;
+  unsigned end = task->end;
+
+  while (begin < end) {
+    while (self && end - begin > range->grain && C_DequeSize(&self->deque) == 0) {
+      unsigned middle = begin + (end - begin) / 2;
+      C_JobSystemPush(sys, (task_t){.range = range, .begin = middle, .end = end});
+      end = middle;
+    }
+
+    unsigned chunk_end = zpl_min(begin + range->grain, end);
+    range->proc(range->data, begin, chunk_end, thread_idx);
+    // Past this point `range` may be gone already, when it lives on the stack
+    // of a C_JobSystemParallelFor
+    bool last = C_JobCounterSub(sys, &range->remaining, chunk_end - begin);
+    begin = chunk_end;
+
+    // Whoever processes the last items completes the node
+    if (last && node) {
+      C_JobGraphComplete(node);
+    }
+  }
+}
+
+static void C_JobSystemRun(job_system_t *sys, thread_data_t *self, task_t *task,
+                           unsigned thread_idx) {
+  if (task->node) {
+    task->node->start = C_ProfilerNow();
+  }
+
+  if (task->range) {
+    C_PROFILER_ZONE("Parallel For");
+    C_JobSystemRunRange(sys, self, task, thread_idx);
+  } else {
+    C_PROFILER_ZONE("Job");
+    task->job.proc(task->job.data, thread_idx);
+    if (task->job.priority == JOB_PRIORITY_BACKGROUND) {
+      atomic_fetch_sub(&sys->background_running, 1);
+    }
+    if (task->job.counter) {
+      C_JobCounterSub(sys, task->job.counter, 1);
+    }
+    if (task->node) {
+      C_JobGraphComplete(task->node);
+    }
+  }
+  atomic_fetch_sub_explicit(&sys->pending, 1, memory_order_release);
+}
 
 long C_JobEntryPoint(struct zpl_thread *thread) {
   thread_data_t *data = thread->user_data;
   unsigned thread_idx = data->idx;
   job_system_t *sys = data->sys;
 
-  for (;;) {
-    zpl_semaphore_wait(&sys->job_count);
+  Current_Thread_Data = data;
+
+  char name[32];
+  sprintf(name, "Worker %u", thread_idx);
+  C_ProfilerSetThreadName(name);
 
-    if (sys->exiting) {
+  unsigned idle = 0;
+  for (;;) {
+    if (atomic_load_explicit(&sys->exiting, memory_order_relaxed)) {
       return 0;
     }
 
-    zpl_mutex_lock(&sys->job_mutex);
-    job_t *the_job = jobs_ring_get(&sys->jobs);
-    zpl_mutex_unlock(&sys->job_mutex);
+    task_t task;
+    if (C_JobSystemFindTask(sys, data, &task, true)) {
+      idle = 0;
+      C_JobSystemRun(sys, data, &task, thread_idx);
+      continue;
+    }
+
+    if (++idle < SPIN_COUNT) {
+      zpl_yield_thread();
+      continue;
+    }
 
-    data->state = THREAD_BUSY;
-    the_job->proc(the_job->data, thread_idx);
-    data->state = THREAD_WAIT;
+    // Announce ourself as sleeping, then check one last time for work pushed
+    // in the meantime, so a wake up can't be lost
+    atomic_fetch_add(&sys->sleepers, 1);
+    if (C_JobSystemFindTask(sys, data, &task, true)) {
+      // If a producer already claimed us, its post will only cause a spurious
+      // wake up later on
+      int sleepers = atomic_load(&sys->sleepers);
+      while (sleepers > 0 && !atomic_compare_exchange_weak(&sys->sleepers, &sleepers, sleepers - 1)) {
+      }
+
+      idle = 0;
+      C_JobSystemRun(sys, data, &task, thread_idx);
+      continue;
+    }
 
-    zpl_atomic32_fetch_add(&sys->job_count_value, -1);
+    zpl_semaphore_wait(&sys->wake);
+    idle = 0;
   }
 
   return 0;
 }
 
 job_system_t *C_JobSystemCreate(unsigned max_threads) {
-  if (max_threads > 32) {
-    printf(LOG_ERROR "A maximum of 32 threads per job system.\n");
-    return NULL;
-  }
-  job_system_t *system = calloc(1, sizeof(job_system_t));
-
-  zpl_atomic32_store(&system->job_count_value, 0);
-  zpl_semaphore_init(&system->job_count);
-  zpl_mutex_init(&system->job_mutex);
-  jobs_ring_init(&system->jobs, zpl_heap_allocator(), 10000);
+  job_system_t *system = zpl_alloc_align(zpl_heap_allocator(), sizeof(job_system_t), 64);
+  memset(system, 0, sizeof(job_system_t));
+
+  system->data = zpl_alloc_align(zpl_heap_allocator(), (max_threads + 1) * sizeof(thread_data_t), 64);
+  memset(system->data, 0, (max_threads + 1) * sizeof(thread_data_t));
+  system->threads = calloc(zpl_max(max_threads, 1), sizeof(zpl_thread));
+
+  atomic_store(&system->pending, 0);
+  atomic_store(&system->sleepers, 0);
+  atomic_store(&system->waiters, 0);
+  atomic_store(&system->background_running, 0);
+  atomic_store(&system->exiting, false);
+  zpl_semaphore_init(&system->wake);
+  zpl_mutex_init(&system->waiter_lock);
+  C_QueueInit(&system->injection);
+  C_QueueInit(&system->background);
 
   system->thread_count = max_threads;
+  system->max_background_running = zpl_max(max_threads / 2, 1);
 
-  for (unsigned i = 0; i < max_threads; i++) {
-    zpl_thread_init(&system->threads[i]);
-
+  for (unsigned i = 0; i < max_threads + 1; i++) {
     system->data[i].sys = system;
     system->data[i].idx = i;
+    system->data[i].seed = i * 2654435761u + 1;
+    C_DequeInit(&system->data[i].deque);
+  }
+
+  // The creating thread owns the last deque
+  Current_Thread_Data = &system->data[max_threads];
+
+  for (unsigned i = 0; i < max_threads; i++) {
+    zpl_thread_init(&system->threads[i]);
 
     zpl_thread_start(&system->threads[i], C_JobEntryPoint, &system->data[i]);
   }
@@ -84,35 +510,276 @@ job_system_t *C_JobSystemCreate(unsigned max_threads) {
 }
 
 void C_JobSystemEnqueue(job_system_t *job_system, job_t job) {
-  zpl_mutex_lock(&job_system->job_mutex);
-  jobs_ring_append(&job_system->jobs, job);
-  zpl_mutex_unlock(&job_system->job_mutex);
-  zpl_atomic32_fetch_add(&job_system->job_count_value, 1);
-  zpl_semaphore_post(&job_system->job_count, 1);
+  C_JobSystemPush(job_system, (task_t){.job = job});
 }
 
-unsigned C_JobSystemQueueEmpty(job_system_t *job_system) {
-  return zpl_atomic32_load(&job_system->job_count_value) == 0;
+void C_JobSystemParallelFor(job_system_t *job_system, unsigned begin,
+                            unsigned end, unsigned grain,
+                            jobs_range_proc_t proc, void *data) {
+  if (begin >= end) {
+    return;
+  }
+
+  unsigned count = end - begin;
+  if (grain == 0) {
+    grain = zpl_max(1, count / (C_JobSystemThreadCount(job_system) * CHUNKS_PER_THREAD));
+  }
+
+  thread_data_t *self = Current_Thread_Data;
+  if (self && self->sys != job_system) {
+    self = NULL;
+  }
+
+  // Lives on our stack, we don't return before every chunk is done
+  parallel_for_t range = {
+      .proc = proc,
+      .data = data,
+      .grain = grain,
+  };
+  atomic_store(&range.remaining.value, count);
+
+  task_t first = {.range = &range, .begin = begin, .end = end};
+  if (!self) {
+    // Not a thread of this job system, it can't help
+    C_JobSystemPush(job_system, first);
+  } else {
+    atomic_fetch_add_explicit(&job_system->pending, 1, memory_order_relaxed);
+    C_JobSystemRun(job_system, self, &first, self->idx);
+  }
+
+  C_JobSystemWait(job_system, &range.remaining);
 }
 
-unsigned C_JobSystemAllDone(job_system_t *job_system) {
-  for (unsigned i = 0; i < job_system->thread_count; i++) {
-    if (job_system->data[i].state == THREAD_BUSY) {
-      // printf("not all thread waiting\n");
-      return false;
+unsigned C_JobCounterDone(job_counter_t *counter) {
+  return atomic_load(&counter->value) == 0;
+}
+
+void C_JobCounterSignal(job_system_t *job_system, job_counter_t *counter) {
+  C_JobCounterSub(job_system, counter, 1);
+}
+
+void C_JobSystemWait(job_system_t *job_system, job_counter_t *counter) {
+  thread_data_t *self = Current_Thread_Data;
+  if (self && self->sys != job_system) {
+    self = NULL;
+  }
+
+  unsigned idle = 0;
+  while (!C_JobCounterDone(counter)) {
+    // Make ourself useful while the counter isn't done. Background jobs are
+    // left alone, picking one could delay our return for a long time.
+    task_t task;
+    if (self && C_JobSystemFindTask(job_system, self, &task, false)) {
+      idle = 0;
+      C_JobSystemRun(job_system, self, &task, self->idx);
+      continue;
+    }
+
+    if (++idle < SPIN_COUNT) {
+      zpl_yield_thread();
+      continue;
+    }
+
+    // Nothing left to help with, park until a counter reaches zero. The
+    // waiter is registered before checking the counter one last time, so
+    // either we see it done or the thread completing it sees us.
+    job_waiter_t waiter = {0};
+    zpl_semaphore_init(&waiter.wake);
+
+    zpl_mutex_lock(&job_system->waiter_lock);
+    waiter.next = job_system->waiter_list;
+    job_system->waiter_list = &waiter;
+    atomic_fetch_add(&job_system->waiters, 1);
+    zpl_mutex_unlock(&job_system->waiter_lock);
+
+    if (C_JobCounterDone(counter)) {
+      zpl_mutex_lock(&job_system->waiter_lock);
+      job_waiter_t **link = &job_system->waiter_list;
+      while (*link && *link != &waiter) {
+        link = &(*link)->next;
+      }
+      if (*link) {
+        *link = waiter.next;
+        atomic_fetch_sub(&job_system->waiters, 1);
+      } else {
+        // Already woken up, the post happened under the lock we hold
+        zpl_semaphore_wait(&waiter.wake);
+      }
+      zpl_mutex_unlock(&job_system->waiter_lock);
+    } else {
+      zpl_semaphore_wait(&waiter.wake);
     }
+
+    zpl_semaphore_destroy(&waiter.wake);
+    idle = 0;
   }
+}
+
+// Push a node whose dependencies are all done
+static void C_JobGraphSchedule(graph_node_t *node) {
+  job_system_t *sys = node->graph->sys;
 
-  unsigned queue_is_empty = C_JobSystemQueueEmpty(job_system);
+  if (!node->range.proc) {
+    C_JobSystemPush(sys, (task_t){.job = node->job, .node = node});
+    return;
+  }
+
+  if (node->begin >= node->end) {
+    node->start = C_ProfilerNow();
+    C_JobGraphComplete(node);
+    return;
+  }
 
-  // printf("all thread waiting && queue_is_empty == %d\n", queue_is_empty);
+  atomic_store(&node->range.remaining.value, node->end - node->begin);
+  C_JobSystemPush(sys, (task_t){.range = &node->range, .begin = node->begin, .end = node->end, .node = node});
+}
+
+static void C_JobGraphComplete(graph_node_t *node) {
+  job_graph_t *graph = node->graph;
+  node->end_time = C_ProfilerNow();
+
+  // Successors are released before the node is accounted as done, otherwise
+  // C_JobGraphRun could return while some of them are still to be pushed
+  uint64_t successors = node->successors;
+  while (successors) {
+    unsigned s = __builtin_ctzll(successors);
+    successors &= successors - 1;
+
+    if (atomic_fetch_sub(&graph->nodes[s].dependencies, 1) == 1) {
+      C_JobGraphSchedule(&graph->nodes[s]);
+    }
+  }
 
-  return queue_is_empty;
+  C_JobCounterSub(graph->sys, &graph->remaining, 1);
+}
+
+job_graph_t *C_JobGraphCreate(job_system_t *job_system) {
+  job_graph_t *graph = calloc(1, sizeof(job_graph_t));
+  graph->sys = job_system;
+
+  return graph;
+}
+
+void C_JobGraphClear(job_graph_t *graph) {
+  graph->node_count = 0;
+}
+
+static unsigned C_JobGraphAddNode(job_graph_t *graph, unsigned reads,
+                                  unsigned writes, graph_node_t **node) {
+  if (graph->node_count == JOB_GRAPH_MAX_NODES) {
+    printf(LOG_ERROR "A maximum of %d nodes per job graph.\n", JOB_GRAPH_MAX_NODES);
+    return JOB_GRAPH_INVALID_NODE;
+  }
+
+  unsigned idx = graph->node_count++;
+  graph_node_t *the_node = &graph->nodes[idx];
+  memset(the_node, 0, sizeof(graph_node_t));
+  the_node->graph = graph;
+  the_node->reads = reads;
+  the_node->writes = writes;
+
+  // Wait for every previous node writing something we touch, or reading
+  // something we write
+  for (unsigned i = 0; i < idx; i++) {
+    graph_node_t *previous = &graph->nodes[i];
+    if ((previous->writes & (reads | writes)) || (previous->reads & writes)) {
+      previous->successors |= (uint64_t)1 << idx;
+      the_node->dependency_count++;
+    }
+  }
+
+  *node = the_node;
+
+  return idx;
+}
+
+unsigned C_JobGraphAddJob(job_graph_t *graph, unsigned reads, unsigned writes,
+                          job_t job) {
+  graph_node_t *node;
+  unsigned idx = C_JobGraphAddNode(graph, reads, writes, &node);
+  if (idx != JOB_GRAPH_INVALID_NODE) {
+    node->job = job;
+  }
+
+  return idx;
+}
+
+unsigned C_JobGraphAddParallelFor(job_graph_t *graph, unsigned reads,
+                                  unsigned writes, unsigned begin, unsigned end,
+                                  unsigned grain, jobs_range_proc_t proc,
+                                  void *data) {
+  graph_node_t *node;
+  unsigned idx = C_JobGraphAddNode(graph, reads, writes, &node);
+  if (idx == JOB_GRAPH_INVALID_NODE) {
+    return idx;
+  }
+
+  if (grain == 0 && end > begin) {
+    grain = zpl_max(1, (end - begin) / (C_JobSystemThreadCount(graph->sys) * CHUNKS_PER_THREAD));
+  }
+
+  node->range = (parallel_for_t){
+      .proc = proc,
+      .data = data,
+      .grain = zpl_max(grain, 1),
+      .node = node,
+  };
+  node->begin = begin;
+  node->end = end;
+
+  return idx;
+}
+
+void C_JobGraphRun(job_graph_t *graph) {
+  if (graph->node_count == 0) {
+    return;
+  }
+
+  atomic_store(&graph->remaining.value, graph->node_count);
+  for (unsigned i = 0; i < graph->node_count; i++) {
+    atomic_store(&graph->nodes[i].dependencies, graph->nodes[i].dependency_count);
+  }
+
+  for (unsigned i = 0; i < graph->node_count; i++) {
+    if (graph->nodes[i].dependency_count == 0) {
+      C_JobGraphSchedule(&graph->nodes[i]);
+    }
+  }
+
+  C_JobSystemWait(graph->sys, &graph->remaining);
+}
+
+void C_JobGraphNodeTime(job_graph_t *graph, unsigned node, double *start,
+                        double *end) {
+  if (node >= graph->node_count) {
+    *start = *end = 0.0;
+    return;
+  }
+
+  *start = graph->nodes[node].start;
+  *end = graph->nodes[node].end_time;
+}
+
+void C_JobGraphDestroy(job_graph_t *graph) {
+  free(graph);
+}
+
+unsigned C_JobSystemThreadCount(job_system_t *job_system) {
+  return job_system->thread_count + 1;
+}
+
+unsigned C_JobSystemQueueEmpty(job_system_t *job_system) {
+  return atomic_load(&job_system->pending) == 0;
+}
+
+unsigned C_JobSystemAllDone(job_system_t *job_system) {
+  // A job is only accounted as done once its proc returned
+  return C_JobSystemQueueEmpty(job_system);
 }
 
 void C_JobSystemDestroy(job_system_t *job_system) {
-  job_system->exiting = true;
-  zpl_semaphore_post(&job_system->job_count, job_system->thread_count);
+  atomic_store(&job_system->exiting, true);
+  zpl_semaphore_post(&job_system->wake, job_system->thread_count);
 
   for (unsigned i = 0; i < job_system->thread_count; i++) {
     zpl_thread_join(&job_system->threads[i]);
@@ -120,7 +787,21 @@ void C_JobSystemDestroy(job_system_t *job_system) {
     zpl_thread_destroy(&job_system->threads[i]);
   }
 
-  jobs_ring_free(&job_system->jobs);
+  for (unsigned i = 0; i < job_system->thread_count + 1; i++) {
+    free(job_system->data[i].deque.buffer);
+  }
+
+  if (Current_Thread_Data && Current_Thread_Data->sys == job_system) {
+    Current_Thread_Data = NULL;
+  }
+
+  zpl_free(zpl_heap_allocator(), job_system->data);
+  free(job_system->threads);
+
+  C_QueueDestroy(&job_system->injection);
+  C_QueueDestroy(&job_system->background);
+  zpl_semaphore_destroy(&job_system->wake);
+  zpl_mutex_destroy(&job_system->waiter_lock);
 
-  free(job_system);
+  zpl_free(zpl_heap_allocator(), job_system);
 }
@@ -1,15 +1,93 @@
 #pragma once
 
+#include <stdatomic.h>
+
 typedef struct job_system_t job_system_t;
+typedef struct job_graph_t job_graph_t;
+
+#define JOB_GRAPH_MAX_NODES 64
+#define JOB_GRAPH_INVALID_NODE ((unsigned)-1)
+
+/// @brief Number of jobs still running or queued for a batch. Zero-initialize
+/// it, then reference it from the jobs of the batch.
+typedef struct job_counter_t {
+  atomic_uint value;
+} job_counter_t;
 
 typedef void (*jobs_proc_t)(void *data, unsigned thread_idx);
+typedef void (*jobs_range_proc_t)(void *data, unsigned begin, unsigned end, unsigned thread_idx);
+
+typedef enum job_priority_t {
+  // Work the current frame waits on, always picked first
+  JOB_PRIORITY_CRITICAL,
+  // Asset loading and such, only run by workers with nothing critical to do,
+  // and never by a thread waiting on a counter. A worker comes back to critical
+  // work once its job returns, keep them to one item each.
+  JOB_PRIORITY_BACKGROUND,
+} job_priority_t;
 
 typedef struct job_t {
   jobs_proc_t proc;
   void *data;
+  job_counter_t *counter; // may be null
+  job_priority_t priority;
 } job_t;
 
 job_system_t *C_JobSystemCreate(unsigned max_threads);
 void C_JobSystemEnqueue(job_system_t* job_system, job_t job);
 unsigned C_JobSystemAllDone(job_system_t* job_system);
 void C_JobSystemDestroy(job_system_t* job_system);
+
+/// @brief Non blocking check, true once every job of the batch is done.
+unsigned C_JobCounterDone(job_counter_t *counter);
+
+/// @brief Decrement `counter` for work done outside of a job, and wake up the
+/// threads waiting on it when it reaches zero.
+void C_JobCounterSignal(job_system_t *job_system, job_counter_t *counter);
+
+/// @brief Return once `counter` reaches zero. Meanwhile the calling thread runs
+/// queued jobs, and sleeps when there's none left.
+void C_JobSystemWait(job_system_t *job_system, job_counter_t *counter);
+
+/// @brief Call `proc` on sub-ranges of [begin, end) from every thread, and
+/// return once the whole range has been processed. The range is split lazily,
+/// only when other threads run out of work, and never below `grain` items (0
+/// lets the job system pick one). The calling thread takes part in the work.
+void C_JobSystemParallelFor(job_system_t *job_system, unsigned begin, unsigned end,
+                            unsigned grain, jobs_range_proc_t proc, void *data);
+
+/// @brief Number of distinct `thread_idx` a job may receive: the workers plus
+/// the thread that created the job system.
+unsigned C_JobSystemThreadCount(job_system_t *job_system);
+
+/// @brief Create an empty graph of jobs to run on `job_system`. Nodes declare
+/// the resources they read and write as bitmasks, and only wait for the
+/// previously added nodes they conflict with. Everything else runs
+/// concurrently.
+job_graph_t *C_JobGraphCreate(job_system_t *job_system);
+
+/// @brief Remove every node, so the graph can be filled again for the next
+/// frame.
+void C_JobGraphClear(job_graph_t *graph);
+
+/// @brief Add a single job to the graph. Return the node index.
+unsigned C_JobGraphAddJob(job_graph_t *graph, unsigned reads, unsigned writes,
+                          job_t job);
+
+/// @brief Add a parallel for to the graph, see C_JobSystemParallelFor. Return
+/// the node index.
+unsigned C_JobGraphAddParallelFor(job_graph_t *graph, unsigned reads,
+                                  unsigned writes, unsigned begin, unsigned end,
+                                  unsigned grain, jobs_range_proc_t proc,
+                                  void *data);
+
+/// @brief Run every node of the graph, and return once they are all done. The
+/// calling thread takes part in the work.
+void C_JobGraphRun(job_graph_t *graph);
+
+/// @brief When a node started and completed during the last run, in
+/// C_ProfilerNow seconds.
+void C_JobGraphNodeTime(job_graph_t *graph, unsigned node, double *start,
+                        double *end);
+
+void C_JobGraphDestroy(job_graph_t *graph);
@@ -1,56 +1,584 @@
 #include <cimgui.h>
 #include <common/c_profiler.h>
+#include <common/c_terminal.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <zpl/zpl.h>
 
-#define NUMBER_RECORDS 16
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <time.h>
+#endif
 
-typedef struct profiler_block_t {
-  zpl_f64 start;
-  zpl_f64 end;
+#define MAX_ZONES 256
+#define MAX_COUNTERS 64
+// Nesting depth tracked per thread, deeper zones are still timed but get
+// attached to the last tracked parent
+#define MAX_DEPTH 64
+// Has to be a power of two
+#define EVENTS_PER_THREAD 16384
+// Samples kept per zone, the window displayed is at most that long
+#define MAX_WINDOW 2048
+#define DEFAULT_WINDOW 256
+// Events kept by the flight recorder, whatever frame they belong to. Has to be
+// a power of two.
+#define RECORDER_EVENTS (1 << 18)
+#define MAX_RECORDED_FRAMES 1024
+#define DEFAULT_RECORDED_FRAMES 120
 
-  zpl_f64 lasts[NUMBER_RECORDS];
-  zpl_f64 mean;
-} profiler_block_t;
+typedef struct profiler_event_t {
+  uint32_t zone;
+  uint32_t parent;
+  double start;
+  double end;
+} profiler_event_t;
+
+// Events of a single thread. Only the owning thread writes, only the thread
+// displaying the profiler reads, so the ring needs no lock.
+typedef struct profiler_thread_t {
+  profiler_event_t events[EVENTS_PER_THREAD];
+  _Alignas(64) atomic_ulong head;
+  _Alignas(64) atomic_ulong tail;
+  atomic_ulong dropped;
+
+  uint32_t stack[MAX_DEPTH];
+  unsigned depth;
+
+  unsigned index;
+  char name[32];
+
+  // Only written by the owning thread, read when a frame ends
+  atomic_ulong counters[MAX_COUNTERS];
+
+  struct profiler_thread_t *next;
+} profiler_thread_t;
+
+typedef struct profiler_counter_stats_t {
+  profiler_counter_t *counter;
+
+  unsigned long total;
+  // Value of each frame kept by the flight recorder, indexed like its frames
+  unsigned long frames[MAX_RECORDED_FRAMES];
+} profiler_counter_stats_t;
+
+typedef struct recorded_event_t {
+  uint32_t zone;
+  uint32_t thread;
+  double start;
+  double end;
+} recorded_event_t;
+
+typedef struct recorded_frame_t {
+  double start;
+  double end;
+} recorded_frame_t;
+
+// Last frames worth of events, filled on the main thread only
+typedef struct flight_recorder_t {
+  recorded_event_t *events;
+  unsigned long event_head;
+
+  recorded_frame_t frames[MAX_RECORDED_FRAMES];
+  unsigned long frame_index;
+  unsigned frame_count; // how many frames are kept
+
+  double last_frame_end;
+
+  double threshold; // ms, 0 when disabled
+  unsigned long next_dump_frame;
+} flight_recorder_t;
+
+typedef struct profiler_zone_stats_t {
+  profiler_zone_t *zone;
+  uint32_t parent;
+
+  float *samples; // ms, MAX_WINDOW of them
+  unsigned sample_head;
+  unsigned sample_count;
+  unsigned long total_calls;
+} profiler_zone_stats_t;
 
 typedef struct profiler_t {
-  profiler_block_t blocks[PROFILER_BLOCK_COUNT];
+  profiler_zone_stats_t zones[MAX_ZONES];
+  atomic_uint zone_count;
+  atomic_flag zone_lock; // also protects counter registration
+
+  profiler_counter_stats_t counters[MAX_COUNTERS];
+  atomic_uint counter_count;
+
+  _Atomic(profiler_thread_t *) threads;
+  atomic_uint thread_count;
+
+  flight_recorder_t recorder;
+
+  int window;
   bool enabled;
 } profiler_t;
 
-profiler_t Global_Profiler = {.enabled = false};
+profiler_t Global_Profiler = {.enabled = false, .zone_lock = ATOMIC_FLAG_INIT};
+
+static _Thread_local profiler_thread_t *Current_Profiler_Thread = NULL;
 
 void C_ProfilerInit(void) {
+  Global_Profiler.window = DEFAULT_WINDOW;
+  Global_Profiler.recorder.events = calloc(RECORDER_EVENTS, sizeof(recorded_event_t));
+  Global_Profiler.recorder.frame_count = DEFAULT_RECORDED_FRAMES;
+  Global_Profiler.recorder.last_frame_end = C_ProfilerNow();
   Global_Profiler.enabled = true;
+
+  C_ProfilerSetThreadName("Main");
+}
+
+double C_ProfilerNow(void) {
+#if defined(_WIN32)
+  static LARGE_INTEGER frequency = {0};
+  if (!frequency.QuadPart) {
+    QueryPerformanceFrequency(&frequency);
+  }
+  LARGE_INTEGER counter;
+  QueryPerformanceCounter(&counter);
+  return (double)counter.QuadPart / (double)frequency.QuadPart;
+#else
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+#endif
+}
+
+static uint32_t C_ProfilerRegisterZone(profiler_zone_t *zone) {
+  uint32_t id = __atomic_load_n(&zone->id, __ATOMIC_ACQUIRE);
+  if (id) {
+    return id;
+  }
+
+  while (atomic_flag_test_and_set_explicit(&Global_Profiler.zone_lock, memory_order_acquire)) {
+  }
+
+  // Somebody else may have registered it while we were spinning
+  id = __atomic_load_n(&zone->id, __ATOMIC_RELAXED);
+  unsigned count = atomic_load(&Global_Profiler.zone_count);
+  if (!id && count < MAX_ZONES) {
+    profiler_zone_stats_t *stats = &Global_Profiler.zones[count];
+    stats->zone = zone;
+    stats->samples = calloc(MAX_WINDOW, sizeof(float));
+
+    id = count + 1;
+    atomic_store(&Global_Profiler.zone_count, count + 1);
+    __atomic_store_n(&zone->id, id, __ATOMIC_RELEASE);
+  }
+
+  atomic_flag_clear_explicit(&Global_Profiler.zone_lock, memory_order_release);
+
+  return id;
+}
+
+static uint32_t C_ProfilerRegisterCounter(profiler_counter_t *counter) {
+  uint32_t id = __atomic_load_n(&counter->id, __ATOMIC_ACQUIRE);
+  if (id) {
+    return id;
+  }
+
+  while (atomic_flag_test_and_set_explicit(&Global_Profiler.zone_lock, memory_order_acquire)) {
+  }
+
+  id = __atomic_load_n(&counter->id, __ATOMIC_RELAXED);
+  unsigned count = atomic_load(&Global_Profiler.counter_count);
+  if (!id && count < MAX_COUNTERS) {
+    Global_Profiler.counters[count].counter = counter;
+
+    id = count + 1;
+    atomic_store(&Global_Profiler.counter_count, count + 1);
+    __atomic_store_n(&counter->id, id, __ATOMIC_RELEASE);
+  }
+
+  atomic_flag_clear_explicit(&Global_Profiler.zone_lock, memory_order_release);
+
+  return id;
+}
+
+static profiler_thread_t *C_ProfilerThread(void) {
+  if (!Current_Profiler_Thread) {
+    profiler_thread_t *thread = calloc(1, sizeof(profiler_thread_t));
+    thread->index = atomic_fetch_add(&Global_Profiler.thread_count, 1);
+    sprintf(thread->name, "Thread %u", thread->index);
+
+    profiler_thread_t *first = atomic_load(&Global_Profiler.threads);
+    do {
+      thread->next = first;
+    } while (!atomic_compare_exchange_weak(&Global_Profiler.threads, &first, thread));
+
+    Current_Profiler_Thread = thread;
+  }
+
+  return Current_Profiler_Thread;
+}
+
+static void C_ProfilerPush(profiler_thread_t *thread, profiler_event_t event) {
+  unsigned long head = atomic_load_explicit(&thread->head, memory_order_relaxed);
+  unsigned long tail = atomic_load_explicit(&thread->tail, memory_order_acquire);
+
+  if (head - tail >= EVENTS_PER_THREAD) {
+    // Nobody displayed the profiler for a while
+    atomic_fetch_add_explicit(&thread->dropped, 1, memory_order_relaxed);
+    return;
+  }
+
+  thread->events[head & (EVENTS_PER_THREAD - 1)] = event;
+  atomic_store_explicit(&thread->head, head + 1, memory_order_release);
+}
+
+profiler_scope_t C_ProfilerBegin(profiler_zone_t *zone) {
+  if (!Global_Profiler.enabled) {
+    return (profiler_scope_t){0};
+  }
+
+  uint32_t id = C_ProfilerRegisterZone(zone);
+  if (!id) {
+    return (profiler_scope_t){0};
+  }
+
+  profiler_thread_t *thread = C_ProfilerThread();
+  if (thread->depth < MAX_DEPTH) {
+    thread->stack[thread->depth] = id;
+  }
+  thread->depth++;
+
+  return (profiler_scope_t){.zone = zone, .start = C_ProfilerNow()};
+}
+
+void C_ProfilerEnd(profiler_scope_t *scope) {
+  if (!scope->zone) {
+    return;
+  }
+
+  double end = C_ProfilerNow();
+
+  profiler_thread_t *thread = C_ProfilerThread();
+  thread->depth--;
+
+  unsigned parent_depth = zpl_min(thread->depth, MAX_DEPTH);
+  C_ProfilerPush(thread, (profiler_event_t){
+                             .zone = scope->zone->id,
+                             .parent = parent_depth ? thread->stack[parent_depth - 1] : 0,
+                             .start = scope->start,
+                             .end = end,
+                         });
+}
+
+void C_ProfilerRecord(profiler_zone_t *zone, double start, double end) {
+  if (!Global_Profiler.enabled) {
+    return;
+  }
+
+  uint32_t id = C_ProfilerRegisterZone(zone);
+  if (!id) {
+    return;
+  }
+
+  profiler_thread_t *thread = C_ProfilerThread();
+
+  unsigned depth = zpl_min(thread->depth, MAX_DEPTH);
+  C_ProfilerPush(thread, (profiler_event_t){
+                             .zone = id,
+                             .parent = depth ? thread->stack[depth - 1] : 0,
+                             .start = start,
+                             .end = end,
+                         });
+}
+
+void C_ProfilerCount(profiler_counter_t *counter, unsigned long amount) {
+  if (!Global_Profiler.enabled) {
+    return;
+  }
+
+  uint32_t id = C_ProfilerRegisterCounter(counter);
+  if (!id) {
+    return;
+  }
+
+  // We're the only writer of our slot, no need for a locked add
+  atomic_ulong *slot = &C_ProfilerThread()->counters[id - 1];
+  atomic_store_explicit(slot, atomic_load_explicit(slot, memory_order_relaxed) + amount, memory_order_relaxed);
+}
+
+// Sum the counters of every thread, the difference with the last sum is what
+// happened during the frame
+static void C_ProfilerCollectCounters(unsigned long frame_index) {
+  unsigned count = atomic_load(&Global_Profiler.counter_count);
+  for (unsigned c = 0; c < count; c++) {
+    profiler_counter_stats_t *stats = &Global_Profiler.counters[c];
+
+    unsigned long total = 0;
+    for (profiler_thread_t *thread = atomic_load(&Global_Profiler.threads); thread; thread = thread->next) {
+      total += atomic_load_explicit(&thread->counters[c], memory_order_relaxed);
+    }
+
+    stats->frames[frame_index % MAX_RECORDED_FRAMES] = total - stats->total;
+    stats->total = total;
+  }
+}
+
+bool C_ProfilerDumpCounters(const char *path) {
+  if (!Global_Profiler.enabled) {
+    return false;
+  }
+
+  flight_recorder_t *recorder = &Global_Profiler.recorder;
+  if (recorder->frame_index == 0) {
+    return false;
+  }
+
+  FILE *f = fopen(path, "w");
+  if (!f) {
+    printf(LOG_ERROR "Couldn't open `%s` to dump the counters.\n", path);
+    return false;
+  }
+
+  unsigned count = atomic_load(&Global_Profiler.counter_count);
+
+  fprintf(f, "frame,frame_ms");
+  for (unsigned c = 0; c < count; c++) {
+    fprintf(f, ",%s", Global_Profiler.counters[c].counter->name);
+  }
+  fprintf(f, "\n");
+
+  unsigned kept = zpl_min(recorder->frame_index, (unsigned long)recorder->frame_count);
+  for (unsigned long i = recorder->frame_index - kept; i < recorder->frame_index; i++) {
+    recorded_frame_t *frame = &recorder->frames[i % MAX_RECORDED_FRAMES];
+    fprintf(f, "%lu,%.3f", i, (frame->end - frame->start) * 1000.0);
+    for (unsigned c = 0; c < count; c++) {
+      fprintf(f, ",%lu", Global_Profiler.counters[c].frames[i % MAX_RECORDED_FRAMES]);
+    }
+    fprintf(f, "\n");
+  }
+
+  fprintf(f, "total,");
+  for (unsigned c = 0; c < count; c++) {
+    fprintf(f, ",%lu", Global_Profiler.counters[c].total);
+  }
+  fprintf(f, "\n");
+
+  fclose(f);
+
+  printf(LOG_VERBOSE "Dumped %u counters over %u frames to `%s`.\n", count, kept, path);
+
+  return true;
+}
+
+// Move the events of every thread to the zone stats
+static void C_ProfilerCollect(void) {
+  for (profiler_thread_t *thread = atomic_load(&Global_Profiler.threads); thread; thread = thread->next) {
+    unsigned long tail = atomic_load_explicit(&thread->tail, memory_order_relaxed);
+    unsigned long head = atomic_load_explicit(&thread->head, memory_order_acquire);
+
+    for (; tail != head; tail++) {
+      profiler_event_t *event = &thread->events[tail & (EVENTS_PER_THREAD - 1)];
+      profiler_zone_stats_t *stats = &Global_Profiler.zones[event->zone - 1];
+
+      // A zone used under several parents is displayed under the first one
+      if (stats->total_calls == 0) {
+        stats->parent = event->parent;
+      }
+
+      stats->samples[stats->sample_head] = (float)((event->end - event->start) * 1000.0);
+      stats->sample_head = (stats->sample_head + 1) % MAX_WINDOW;
+      stats->sample_count = zpl_min(stats->sample_count + 1, MAX_WINDOW);
+      stats->total_calls++;
+
+      flight_recorder_t *recorder = &Global_Profiler.recorder;
+      recorder->events[recorder->event_head & (RECORDER_EVENTS - 1)] = (recorded_event_t){
+          .zone = event->zone,
+          .thread = thread->index,
+          .start = event->start,
+          .end = event->end,
+      };
+      recorder->event_head++;
+    }
+
+    atomic_store_explicit(&thread->tail, tail, memory_order_release);
+  }
 }
 
-void C_ProfilerStartBlock(profiler_block_name_t block) {
+void C_ProfilerSetThreadName(const char *name) {
   if (!Global_Profiler.enabled) {
     return;
   }
 
-  Global_Profiler.blocks[block].start = zpl_time_rel();
+  profiler_thread_t *thread = C_ProfilerThread();
+  snprintf(thread->name, sizeof(thread->name), "%s", name);
+}
+
+void C_ProfilerSetTraceThreshold(double ms) {
+  Global_Profiler.recorder.threshold = ms;
+}
+
+void C_ProfilerSetRecordedFrames(unsigned count) {
+  Global_Profiler.recorder.frame_count = zpl_clamp(count, 1, MAX_RECORDED_FRAMES);
 }
 
-void C_ProfilerEndBlock(profiler_block_name_t block) {
+// Names are free text, quote them as JSON strings
+static void C_ProfilerWriteString(FILE *f, const char *s) {
+  fputc('"', f);
+  for (; *s; s++) {
+    if (*s == '"' || *s == '\\') {
+      fputc('\\', f);
+      fputc(*s, f);
+    } else if ((unsigned char)*s < 0x20) {
+      fprintf(f, "\\u%04x", (unsigned char)*s);
+    } else {
+      fputc(*s, f);
+    }
+  }
+  fputc('"', f);
+}
+
+bool C_ProfilerDumpTrace(const char *path) {
+  if (!Global_Profiler.enabled) {
+    return false;
+  }
+
+  C_ProfilerCollect();
+
+  flight_recorder_t *recorder = &Global_Profiler.recorder;
+  if (recorder->frame_index == 0) {
+    return false;
+  }
+
+  FILE *f = fopen(path, "w");
+  if (!f) {
+    printf(LOG_ERROR "Couldn't open `%s` to dump the trace.\n", path);
+    return false;
+  }
+
+  // Everything that ended after the start of the oldest frame kept
+  unsigned kept = zpl_min(recorder->frame_index, (unsigned long)recorder->frame_count);
+  double origin = recorder->frames[(recorder->frame_index - kept) % MAX_RECORDED_FRAMES].start;
+
+  fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+  bool first = true;
+  for (profiler_thread_t *thread = atomic_load(&Global_Profiler.threads); thread; thread = thread->next) {
+    fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":",
+            first ? "" : ",\n", thread->index);
+    C_ProfilerWriteString(f, thread->name);
+    fprintf(f, "}}");
+    first = false;
+  }
+
+  unsigned long count = zpl_min(recorder->event_head, (unsigned long)RECORDER_EVENTS);
+  for (unsigned long i = recorder->event_head - count; i < recorder->event_head; i++) {
+    recorded_event_t *event = &recorder->events[i & (RECORDER_EVENTS - 1)];
+    if (event->end < origin) {
+      continue;
+    }
+
+    fprintf(f, "%s{\"name\":", first ? "" : ",\n");
+    C_ProfilerWriteString(f, Global_Profiler.zones[event->zone - 1].zone->name);
+    fprintf(f, ",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}", event->thread,
+            (event->start - origin) * 1e6, (event->end - event->start) * 1e6);
+    first = false;
+  }
+
+  fprintf(f, "\n]}\n");
+  fclose(f);
+
+  printf(LOG_VERBOSE "Dumped the last %d frames to `%s`.\n", kept, path);
+
+  return true;
+}
+
+void C_ProfilerFrameEnd(void) {
+  static profiler_zone_t frame_zone = {.name = "Frame"};
+
   if (!Global_Profiler.enabled) {
     return;
   }
 
-  Global_Profiler.blocks[block].end = zpl_time_rel();
+  flight_recorder_t *recorder = &Global_Profiler.recorder;
+
+  double now = C_ProfilerNow();
+  double start = recorder->last_frame_end;
+  recorder->last_frame_end = now;
+
+  C_ProfilerRecord(&frame_zone, start, now);
+  C_ProfilerCollect();
 
-  zpl_f64 total = Global_Profiler.blocks[block].end - Global_Profiler.blocks[block].start;
+  recorder->frames[recorder->frame_index % MAX_RECORDED_FRAMES] = (recorded_frame_t){
+      .start = start,
+      .end = now,
+  };
+  C_ProfilerCollectCounters(recorder->frame_index);
+  recorder->frame_index++;
 
-  for (unsigned i = 0; i < NUMBER_RECORDS - 1; i++) {
-    Global_Profiler.blocks[block].lasts[i] = Global_Profiler.blocks[block].lasts[i + 1];
+  // Once a slow frame has been dumped, wait for the recorder to be filled with
+  // new frames before dumping another one
+  double ms = (now - start) * 1000.0;
+  if (recorder->threshold > 0.0 && ms > recorder->threshold &&
+      recorder->frame_index >= recorder->next_dump_frame) {
+    char path[64];
+    sprintf(path, "slow_frame_%lu.json", recorder->frame_index);
+    printf(LOG_WARNING "Frame took %.03fms, over the %.03fms threshold.\n", ms, recorder->threshold);
+    C_ProfilerDumpTrace(path);
+
+    recorder->next_dump_frame = recorder->frame_index + recorder->frame_count;
   }
+}
 
-  Global_Profiler.blocks[block].lasts[NUMBER_RECORDS - 1] = total;
+static int C_ProfilerCompareSamples(const void *a, const void *b) {
+  float fa = *(const float *)a;
+  float fb = *(const float *)b;
+  return (fa > fb) - (fa < fb);
+}
+
+static float C_ProfilerPercentile(float *sorted, unsigned count, float p) {
+  unsigned rank = (unsigned)ceilf(p * count);
+  return sorted[zpl_clamp(rank, 1, count) - 1];
+}
 
-  Global_Profiler.blocks[block].mean = 0.0f;
-  for (unsigned i = 0; i < NUMBER_RECORDS; i++) {
-    Global_Profiler.blocks[block].mean += Global_Profiler.blocks[block].lasts[i];
+static void C_ProfilerDisplayZone(uint32_t id, unsigned depth) {
+  static float sorted[MAX_WINDOW];
+
+  profiler_zone_stats_t *stats = &Global_Profiler.zones[id - 1];
+
+  // The window only covers the last samples recorded
+  unsigned count = zpl_min(stats->sample_count, (unsigned)Global_Profiler.window);
+  for (unsigned i = 0; i < count; i++) {
+    sorted[i] = stats->samples[(stats->sample_head + MAX_WINDOW - count + i) % MAX_WINDOW];
+  }
+  qsort(sorted, count, sizeof(float), C_ProfilerCompareSamples);
+
+  ImGui_TableNextRow();
+  ImGui_TableSetColumnIndex(0);
+  ImGui_Text("%*s%s", depth * 2, "", stats->zone->name);
+  ImGui_TableSetColumnIndex(1);
+  ImGui_Text("%lu", stats->total_calls);
+  if (count != 0) {
+    ImGui_TableSetColumnIndex(2);
+    ImGui_Text("%.03f", C_ProfilerPercentile(sorted, count, 0.50f));
+    ImGui_TableSetColumnIndex(3);
+    ImGui_Text("%.03f", C_ProfilerPercentile(sorted, count, 0.95f));
+    ImGui_TableSetColumnIndex(4);
+    ImGui_Text("%.03f", C_ProfilerPercentile(sorted, count, 0.99f));
+    ImGui_TableSetColumnIndex(5);
+    ImGui_Text("%.03f", sorted[count - 1]);
+  }
+
+  // Zones recorded under each other on different threads would loop forever
+  if (depth >= MAX_DEPTH) {
+    return;
+  }
+
+  unsigned zone_count = atomic_load(&Global_Profiler.zone_count);
+  for (unsigned i = 0; i < zone_count; i++) {
+    if (Global_Profiler.zones[i].parent == id && i + 1 != id && Global_Profiler.zones[i].total_calls != 0) {
+      C_ProfilerDisplayZone(i + 1, depth + 1);
+    }
   }
-  Global_Profiler.blocks[block].mean /= NUMBER_RECORDS;
 }
 
 void C_ProfilerDisplay(void) {
@@ -58,22 +586,62 @@ void C_ProfilerDisplay(void) {
     return;
   }
 
+  C_ProfilerCollect();
+
   ImGui_Begin("Profiler data", NULL, 0);
 
-  float game_tick = Global_Profiler.blocks[PROFILER_BLOCK_GAME_TICK].mean;
-  ImGui_Text("Game Tick: %.03fms", game_tick * 1000.0f);
+  ImGui_SliderInt("Window (samples)", &Global_Profiler.window, 16, MAX_WINDOW);
+
+  unsigned long dropped = 0;
+  for (profiler_thread_t *thread = atomic_load(&Global_Profiler.threads); thread; thread = thread->next) {
+    dropped += atomic_load_explicit(&thread->dropped, memory_order_relaxed);
+  }
+  if (dropped) {
+    ImGui_Text("%lu events dropped", dropped);
+  }
+
+  if (ImGui_BeginTable("profiler_zones", 6, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg)) {
+    ImGui_TableSetupColumn("Zone", 0);
+    ImGui_TableSetupColumn("Calls", 0);
+    ImGui_TableSetupColumn("p50 (ms)", 0);
+    ImGui_TableSetupColumn("p95 (ms)", 0);
+    ImGui_TableSetupColumn("p99 (ms)", 0);
+    ImGui_TableSetupColumn("max (ms)", 0);
+    ImGui_TableHeadersRow();
+
+    unsigned zone_count = atomic_load(&Global_Profiler.zone_count);
+    for (unsigned i = 0; i < zone_count; i++) {
+      if (Global_Profiler.zones[i].parent == 0 && Global_Profiler.zones[i].total_calls != 0) {
+        C_ProfilerDisplayZone(i + 1, 0);
+      }
+    }
 
-  float path_finding = Global_Profiler.blocks[PROFILER_BLOCK_PATH_FINDING].mean;
-  ImGui_Text("Path Finding: %.03fms", path_finding * 1000.0f);
+    ImGui_EndTable();
+  }
 
-  float agent_thinking = Global_Profiler.blocks[PROFILER_BLOCK_THINK].mean;
-  ImGui_Text("Agent Thinking: %.03fms", agent_thinking * 1000.0f);
+  unsigned counter_count = atomic_load(&Global_Profiler.counter_count);
+  if (counter_count && ImGui_BeginTable("profiler_counters", 3, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg)) {
+    ImGui_TableSetupColumn("Counter", 0);
+    ImGui_TableSetupColumn("Last frame", 0);
+    ImGui_TableSetupColumn("Total", 0);
+    ImGui_TableHeadersRow();
 
-  float setup_tile = Global_Profiler.blocks[PROFILER_BLOCK_SETUP_TILE_TEXT].mean;
-  ImGui_Text("Setup Tile Text: %.03fms", setup_tile * 1000.0f);
+    flight_recorder_t *recorder = &Global_Profiler.recorder;
+    for (unsigned c = 0; c < counter_count; c++) {
+      profiler_counter_stats_t *stats = &Global_Profiler.counters[c];
+      unsigned long last = recorder->frame_index ? stats->frames[(recorder->frame_index - 1) % MAX_RECORDED_FRAMES] : 0;
 
-  float scene_update = Global_Profiler.blocks[PROFILER_BLOCK_SCENE_UPDATE].mean;
-  ImGui_Text("Scene Update: %.03fms", scene_update * 1000.0f);
+      ImGui_TableNextRow();
+      ImGui_TableSetColumnIndex(0);
+      ImGui_TextUnformatted(stats->counter->name);
+      ImGui_TableSetColumnIndex(1);
+      ImGui_Text("%lu", last);
+      ImGui_TableSetColumnIndex(2);
+      ImGui_Text("%lu", stats->total);
+    }
+
+    ImGui_EndTable();
+  }
 
   ImGui_End();
 }
@@ -1,22 +1,92 @@
 #pragma once
 
+#include <stdbool.h>
+
 typedef struct profiler_t profiler_t;
 
-typedef enum profiler_block_name_t {
-  PROFILER_BLOCK_GAME_TICK,
-  PROFILER_BLOCK_SCENE_UPDATE,
-  PROFILER_BLOCK_CAMERA_UPDATE,
-  PROFILER_BLOCK_PATH_FINDING,
-  PROFILER_BLOCK_THINK,
-  PROFILER_BLOCK_VK_SYSTEM_UPDATE,
-  PROFILER_BLOCK_SETUP_TILE_TEXT,
+/// @brief A named zone. Declare it `static` where it's used, it registers
+/// itself the first time it's recorded. Use C_PROFILER_ZONE instead of
+/// declaring one by hand.
+typedef struct profiler_zone_t {
+  const char *name;
+  unsigned id; // 0 until registered
+} profiler_zone_t;
+
+/// @brief A named counter, same registration rules as zones. Use
+/// C_PROFILER_COUNT instead of declaring one by hand.
+typedef struct profiler_counter_t {
+  const char *name;
+  unsigned id; // 0 until registered
+} profiler_counter_t;
 
-  PROFILER_BLOCK_COUNT,
-} profiler_block_name_t;
+typedef struct profiler_scope_t {
+  profiler_zone_t *zone;
+  double start;
+} profiler_scope_t;
 
 void C_ProfilerInit(void);
 
-void C_ProfilerStartBlock(profiler_block_name_t block);
-void C_ProfilerEndBlock(profiler_block_name_t block);
+/// @brief Monotonic time in seconds, with sub-microsecond resolution.
+/// zpl_time_rel only counts milliseconds, which is too coarse for zones.
+double C_ProfilerNow(void);
+
+/// @brief Start timing `zone` on the calling thread. Zones started while
+/// another one is running on the same thread are displayed as its children.
+profiler_scope_t C_ProfilerBegin(profiler_zone_t *zone);
+void C_ProfilerEnd(profiler_scope_t *scope);
+
+/// @brief Account a zone measured somewhere else, typically by a job graph
+/// node running on another thread. `start` and `end` come from C_ProfilerNow.
+void C_ProfilerRecord(profiler_zone_t *zone, double start, double end);
+
+/// @brief Add `amount` to a counter. Cheap enough for hot loops of any thread,
+/// each thread bumps its own copy without any atomic read-modify-write.
+void C_ProfilerCount(profiler_counter_t *counter, unsigned long amount);
+
+/// @brief Write the per-frame values of every counter over the frames kept by
+/// the flight recorder as CSV, followed by the cumulative values.
+bool C_ProfilerDumpCounters(const char *path);
 
 void C_ProfilerDisplay(void);
+
+/// @brief Name the calling thread in exported traces.
+void C_ProfilerSetThreadName(const char *name);
+
+/// @brief Call once per frame from the main thread. Moves the events recorded
+/// by every thread to the flight recorder, which keeps the last frames around,
+/// and dumps them when the frame was slower than the trace threshold.
+void C_ProfilerFrameEnd(void);
+
+/// @brief Write the frames held by the flight recorder as a Chrome trace JSON
+/// file, to open in chrome://tracing or Perfetto.
+bool C_ProfilerDumpTrace(const char *path);
+
+/// @brief Frames slower than `ms` are dumped automatically, 0 disables it.
+void C_ProfilerSetTraceThreshold(double ms);
+
+/// @brief How many frames the flight recorder keeps.
+void C_ProfilerSetRecordedFrames(unsigned count);
+
+#define C_PROFILER_CAT_(a, b) a##b
+#define C_PROFILER_CAT(a, b) C_PROFILER_CAT_(a, b)
+
+/// @brief Time the rest of the enclosing block as `zone_name`. Can be used from
+/// any thread, and nested.
+#define C_PROFILER_ZONE(zone_name)                                                     \
+  static profiler_zone_t C_PROFILER_CAT(Profiler_Zone_, __LINE__) = {.name = zone_name}; \
+  profiler_scope_t C_PROFILER_CAT(profiler_scope_, __LINE__)                           \
+      __attribute__((cleanup(C_ProfilerEnd))) = C_ProfilerBegin(&C_PROFILER_CAT(Profiler_Zone_, __LINE__))
+
+/// @brief Bump the counter `counter_name` by `amount`.
+#define C_PROFILER_COUNT(counter_name, amount)                                               \
+  do {                                                                                       \
+    static profiler_counter_t C_PROFILER_CAT(Profiler_Counter_, __LINE__) = {.name = counter_name}; \
+    C_ProfilerCount(&C_PROFILER_CAT(Profiler_Counter_, __LINE__), amount);                  \
+  } while (0)
+
+/// @brief Same as C_ProfilerRecord, with a zone declared on the spot.
+#define C_PROFILER_RECORD(zone_name, start, end)                                       \
+  do {                                                                                 \
+    static profiler_zone_t C_PROFILER_CAT(Profiler_Zone_, __LINE__) = {.name = zone_name}; \
+    C_ProfilerRecord(&C_PROFILER_CAT(Profiler_Zone_, __LINE__), start, end);          \
+  } while (0)
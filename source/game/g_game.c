@@ -12,6 +12,7 @@
 #include <freetype/freetype.h>
 #include <game/g_game.h>
 #include <game/g_private.h>
+#include <hpa.h>
 #include <intlist.h>
 #include <jps.h>
 #include <math.h>
@@ -27,7 +28,8 @@
 #include <vk/vk_vulkan.h>
 
 void G_WorkerRegisterThread(void *data, unsigned thread_idx);
-void G_WorkerSetupTileText(void *data, unsigned thread_idx);
+void G_WorkerSetupTileText(void *data, unsigned begin, unsigned end,
+                           unsigned thread_idx);
 void G_WorkerLoadTexture(void *data, unsigned thread_idx);
 void G_WorkerLoadFont(void *data, unsigned thread_idx);
 
@@ -46,6 +48,12 @@ game_t *G_CreateGame(client_t *client, char *base) {
   game_t *game = calloc(1, sizeof(game_t));
 
   game->cpu_agents = calloc(3000, sizeof(cpu_agent_t));
+  game->agent_inventories = calloc(3000, sizeof(agent_inventory_t));
+
+  game->queries[ENTITY_QUERY_AGENTS].signature = agent_signature;
+  for (unsigned q = 0; q < ENTITY_QUERY_COUNT; q++) {
+    game->queries[q].entities = calloc(3000, sizeof(unsigned));
+  }
 
   game->map_textures = calloc(32, sizeof(texture_t));
   game->map_texture_capacity = 32;
@@ -74,11 +82,33 @@ game_t *G_CreateGame(client_t *client, char *base) {
 
   zpl_affinity af;
   zpl_affinity_init(&af);
-  // The workers[0] is actually the main thread ok?
+  // The main thread takes part in the jobs as well, it gets the last worker
+  // index
   game->worker_count = af.thread_count;
+  unsigned worker_cap = CL_GetWorkerCap(client);
+  if (worker_cap != 0 && worker_cap < game->worker_count) {
+    game->worker_count = worker_cap;
+  }
+  // Loading jobs need at least one worker while the main thread draws the
+  // loading screen
+  if (game->worker_count < 2) {
+    game->worker_count = 2;
+  }
   printf(LOG_VERBOSE "Game will run on %d threads.\n", game->worker_count);
 
-  game->job_sys2 = C_JobSystemCreate(game->worker_count);
+  game->qcvms = calloc(game->worker_count, sizeof(qcvm_t *));
+  game->path_budget = PATH_REQUEST_BUDGET_MS;
+
+  game->job_sys2 = C_JobSystemCreate(game->worker_count - 1);
+  game->frame_graph = C_JobGraphCreate(game->job_sys2);
+
+  game->frame_memory = zpl_alloc_align(zpl_heap_allocator(), game->worker_count * sizeof(frame_memory_t), 64);
+  for (unsigned i = 0; i < game->worker_count; i++) {
+    frame_memory_t *memory = &game->frame_memory[i];
+    memset(memory, 0, sizeof(frame_memory_t));
+    zpl_arena_init_from_allocator(&memory->arena, zpl_heap_allocator(), FRAME_ARENA_SIZE);
+    memory->path_list = il_create(2);
+  }
 
   zpl_affinity_destroy(&af);
 
@@ -201,43 +231,98 @@ void G_DestroyGame(game_t *game) {
   G_Walls_destroy(&game->wall_bank);
   G_Terrains_destroy(&game->terrain_bank);
 
-  for (unsigned i = 0; i < game->entity_count; i++) {
-    if (game->cpu_agents[i].inventory_initialized) {
-      G_Inventory_destroy(&game->cpu_agents[i].inventory);
-    }
-    if (game->cpu_agents[i].computed_path.points) {
-      free(game->cpu_agents[i].computed_path.points);
+  entity_query_t *agent_query = &game->queries[ENTITY_QUERY_AGENTS];
+  for (unsigned a = 0; a < agent_query->count; a++) {
+    unsigned entity = agent_query->entities[a];
+    if (game->agent_inventories[entity].initialized) {
+      G_Inventory_destroy(&game->agent_inventories[entity].items);
     }
   }
 
-  for (unsigned i = 0; i < 16; i++) {
+  for (unsigned i = 0; i < game->worker_count; i++) {
     qcvm_free(game->qcvms[i]);
   }
+  free(game->qcvms);
 
   G_Scene_Destroy(game, game->current_scene);
+  G_PathRequests_Destroy(&game->path_requests);
 
+  C_JobGraphDestroy(game->frame_graph);
   C_JobSystemDestroy(game->job_sys2);
 
+  G_ResetFrameMemory(game);
+  for (unsigned i = 0; i < game->worker_count; i++) {
+    zpl_arena_free(&game->frame_memory[i].arena);
+    free(game->frame_memory[i].overflows);
+    il_destroy(game->frame_memory[i].path_list);
+  }
+  zpl_free(zpl_heap_allocator(), game->frame_memory);
+
   FT_Done_Face(game->console_face);
   FT_Done_Face(game->game_face);
   FT_Done_FreeType(game->console_ft);
   FT_Done_FreeType(game->game_ft);
 
   free(game->cpu_agents);
+  free(game->agent_inventories);
+  for (unsigned q = 0; q < ENTITY_QUERY_COUNT; q++) {
+    free(game->queries[q].entities);
+  }
   free(game->scenes);
   free(game);
 }
 
-void G_WorkerThinkAgent(void *data, unsigned thread_idx) {
+void *G_FrameAlloc(game_t *game, unsigned thread_idx, zpl_isize size) {
+  frame_memory_t *memory = &game->frame_memory[thread_idx];
+
+  void *ptr = zpl_alloc(zpl_arena_allocator(&memory->arena), size);
+  if (ptr) {
+    return ptr;
+  }
+
+  // Don't fail the tick, fall back to the heap and remember the arena has to
+  // be bigger
+  if (memory->overflow_count == memory->overflow_capacity) {
+    memory->overflow_capacity = memory->overflow_capacity ? memory->overflow_capacity * 2 : 16;
+    memory->overflows = realloc(memory->overflows, memory->overflow_capacity * sizeof(void *));
+  }
+  ptr = calloc(1, size);
+  memory->overflows[memory->overflow_count++] = ptr;
+  memory->overflow_size += size;
+
+  return ptr;
+}
+
+void G_ResetFrameMemory(game_t *game) {
+  for (unsigned i = 0; i < game->worker_count; i++) {
+    frame_memory_t *memory = &game->frame_memory[i];
+
+    if (memory->overflow_count != 0) {
+      for (unsigned o = 0; o < memory->overflow_count; o++) {
+        free(memory->overflows[o]);
+      }
+
+      zpl_isize new_size = (memory->arena.total_size + memory->overflow_size) * 2;
+      printf(LOG_VERBOSE "Frame arena of thread %d grows to %ldKB.\n", i, (long)(new_size / 1024));
+      zpl_arena_free(&memory->arena);
+      zpl_arena_init_from_allocator(&memory->arena, zpl_heap_allocator(), new_size);
+
+      memory->overflow_count = 0;
+      memory->overflow_size = 0;
+    }
+
+    zpl_free_all(zpl_arena_allocator(&memory->arena));
+  }
+}
+
+void G_WorkerThinkAgent(void *data, unsigned begin, unsigned end,
+                        unsigned thread_idx) {
   think_job_t *job = data;
   game_t *game = job->game;
-  if (job->agent_count == 0) {
-    printf("wtf?\n");
-  }
-  for (unsigned b = 0; b < job->agent_count; b++) {
-    unsigned agent = job->agents[b];
+  qcvm_t *qcvm = game->qcvms[thread_idx];
 
-    qcvm_t *qcvm = game->qcvms[thread_idx];
+  for (unsigned b = begin; b < end; b++) {
+    unsigned agent = job->agents[b];
 
     for (unsigned t = 0; t < game->current_scene->agent_think_listener_count; t++) {
       qcvm_set_parm_int(qcvm, 0, game->current_scene->current_map);
@@ -251,93 +336,75 @@ void G_WorkerThinkAgent(void *data, unsigned thread_idx) {
   }
 }
 
-void G_WorkerUpdateAgents(void *data, unsigned thread_idx) {
-  path_finding_job_t *the_job = data;
+void G_WorkerUpdateAgent(path_finding_job_t *the_job, unsigned agent,
+                         unsigned thread_idx) {
   float delta = the_job->delta / 0.01666666;
   game_t *game = the_job->game;
-  unsigned agent = the_job->agent;
   map_t *the_map = &game->current_scene->maps[the_job->map];
 
-  if (game->cpu_agents[agent].state == AGENT_PATH_FINDING) {
-    struct map *jps_map = the_map->jps_maps[thread_idx];
-
-    jps_set_start(jps_map, game->transforms[agent].position[0],
-                  game->transforms[agent].position[1]);
-    jps_set_end(jps_map, game->cpu_agents[agent].target[0],
-                game->cpu_agents[agent].target[1]);
-
-    IntList *list = il_create(2);
-    jps_path_finding(jps_map, 2, list);
-
-    unsigned size = il_size(list);
-
-    if (game->cpu_agents[agent].computed_path.points) {
-      free(game->cpu_agents[agent].computed_path.points);
-      game->cpu_agents[agent].computed_path.points = NULL;
-    }
-
-    if (size == 0) {
-      game->cpu_agents[agent].state = AGENT_NOTHING;
-      il_destroy(list);
-      return;
+  // Paths are searched before, see G_WorkerServePathRequests
+  if (game->cpu_agents[agent].state == AGENT_MOVING) {
+    vec2 next_pos;
+    if (game->cpu_agents[agent].flow_field) {
+      // Fields only tell the next tile, ask again once it's reached
+      if (game->transforms[agent].position[0] == game->cpu_agents[agent].flow_next[0] &&
+          game->transforms[agent].position[1] == game->cpu_agents[agent].flow_next[1] &&
+          !G_Map_FollowFlowField(the_map, &game->cpu_agents[agent],
+                                 game->transforms[agent].position)) {
+        game->gpu_agents[agent].direction[0] = 0.0f;
+        game->gpu_agents[agent].direction[1] = 0.0f;
+        return;
+      }
+      glm_vec2(game->cpu_agents[agent].flow_next, next_pos);
+    } else {
+      cpu_path_t *path = &game->cpu_agents[agent].computed_path;
+      if (path->current >= path->count) {
+        G_Path_Release(path);
+        game->cpu_agents[agent].state = AGENT_NOTHING;
+        game->gpu_agents[agent].direction[0] = 0.0f;
+        game->gpu_agents[agent].direction[1] = 0.0f;
+        return;
+      }
+      G_Path_Point(path, next_pos);
     }
 
-    game->cpu_agents[agent].computed_path.count = size;
-    game->cpu_agents[agent].computed_path.current = 0;
-    game->cpu_agents[agent].computed_path.points = calloc(size, sizeof(vec2));
+    // Compute the direction to take
+    vec2 d;
+    glm_vec2_sub(next_pos, game->transforms[agent].position, d);
+    vec2 s;
+    glm_vec2_sign(d, s);
+    d[0] = glm_min(fabs(d[0]), game->cpu_agents[agent].speed * delta) * s[0];
+    d[1] = glm_min(fabs(d[1]), game->cpu_agents[agent].speed * delta) * s[1];
+
+    // Reflect the direction on the related GPU agent
+    // Visual and Animation is supposed to change
+    vec2 supposed_d = {
+        1.0f * s[0],
+        1.0f * s[1],
+    };
 
-    for (unsigned p = 0; p < size; p++) {
-      int x = il_get(list, (size - p - 1), 0);
-      int y = il_get(list, (size - p - 1), 1);
-      game->cpu_agents[agent].computed_path.points[p][0] = x;
-      game->cpu_agents[agent].computed_path.points[p][1] = y;
+    if (supposed_d[0] != 0.0f || supposed_d[1] != 0.0f) {
+      game->gpu_agents[agent].direction[0] = supposed_d[0];
+      game->gpu_agents[agent].direction[1] = supposed_d[1];
     }
 
-    game->cpu_agents[agent].state = AGENT_MOVING;
-
-    il_destroy(list);
-  } else if (game->cpu_agents[agent].state == AGENT_MOVING) {
-    unsigned c = game->cpu_agents[agent].computed_path.current;
-    if (c < game->cpu_agents[agent].computed_path.count) {
-      // Compute the direction to take
-      vec2 next_pos;
-      glm_vec2(game->cpu_agents[agent].computed_path.points[c], next_pos);
-      vec2 d;
-      glm_vec2_sub(next_pos, game->transforms[agent].position, d);
-      vec2 s;
-      glm_vec2_sign(d, s);
-      d[0] = glm_min(fabs(d[0]), game->cpu_agents[agent].speed * delta) * s[0];
-      d[1] = glm_min(fabs(d[1]), game->cpu_agents[agent].speed * delta) * s[1];
-
-      // Reflect the direction on the related GPU agent
-      // Visual and Animation is supposed to change
-      vec2 supposed_d = {
-          1.0f * s[0],
-          1.0f * s[1],
-      };
-
-      if (supposed_d[0] != 0.0f || supposed_d[1] != 0.0f) {
-        game->gpu_agents[agent].direction[0] = supposed_d[0];
-        game->gpu_agents[agent].direction[1] = supposed_d[1];
-      }
+    // Apply the movement
+    glm_vec2_add(game->transforms[agent].position, d,
+                 game->transforms[agent].position);
+    if (!game->cpu_agents[agent].flow_field &&
+        game->transforms[agent].position[0] == next_pos[0] &&
+        game->transforms[agent].position[1] == next_pos[1]) {
+      G_Path_Advance(&game->cpu_agents[agent].computed_path);
+    }
+  }
+}
 
-      // Apply the movement
-      glm_vec2_add(game->transforms[agent].position, d,
-                   game->transforms[agent].position);
-      if (game->transforms[agent].position[0] == next_pos[0] &&
-          game->transforms[agent].position[1] == next_pos[1]) {
-        game->cpu_agents[agent].computed_path.current++;
-      }
-    } else {
-      game->cpu_agents[agent].state = AGENT_NOTHING;
-      game->gpu_agents[agent].direction[0] = 0.0f;
-      game->gpu_agents[agent].direction[1] = 0.0f;
+void G_WorkerUpdateAgents(void *data, unsigned begin, unsigned end,
+                          unsigned thread_idx) {
+  path_finding_job_t *the_job = data;
 
-      if (game->cpu_agents[agent].computed_path.points) {
-        free(game->cpu_agents[agent].computed_path.points);
-        game->cpu_agents[agent].computed_path.points = NULL;
-      }
-    }
+  for (unsigned a = begin; a < end; a++) {
+    G_WorkerUpdateAgent(the_job, the_job->agents[a], thread_idx);
   }
 }
 
@@ -353,8 +420,9 @@ void G_ResetGameState(game_t *game) {
 }
 
 game_state_t *G_TickGame(client_t *client, game_t *game) {
-  C_ProfilerStartBlock(PROFILER_BLOCK_GAME_TICK);
+  C_PROFILER_ZONE("Game Tick");
   G_ResetGameState(game);
+  G_ResetFrameMemory(game);
 
   // destroy previous scene, and load new one
   if (game->next_scene && CL_GetClientState(client) == CLIENT_RUNNING) {
@@ -391,124 +459,128 @@ game_state_t *G_TickGame(client_t *client, game_t *game) {
   if (!game->current_scene) {
     printf(LOG_WARNING "No current scene hehe...\n");
   } else {
-    C_ProfilerStartBlock(PROFILER_BLOCK_SCENE_UPDATE);
-    for (unsigned i = 0; i < game->current_scene->update_listener_count; i++) {
-      qcvm_set_parm_float(game->qcvms[0], 0, game->delta_time);
-      qcvm_run(game->qcvms[0],
-               game->current_scene->update_listeners[i].qcvm_func);
-    }
-    C_ProfilerEndBlock(PROFILER_BLOCK_SCENE_UPDATE);
-
-    C_ProfilerStartBlock(PROFILER_BLOCK_CAMERA_UPDATE);
-    for (unsigned i = 0; i < game->current_scene->camera_update_listener_count;
-         i++) {
-      qcvm_set_parm_float(game->qcvms[0], 0, game->delta_time);
-      qcvm_run(game->qcvms[0],
-               game->current_scene->camera_update_listeners[i].qcvm_func);
+    {
+      C_PROFILER_ZONE("Scene Update");
+      for (unsigned i = 0; i < game->current_scene->update_listener_count; i++) {
+        qcvm_set_parm_float(game->qcvms[0], 0, game->delta_time);
+        qcvm_run(game->qcvms[0],
+                 game->current_scene->update_listeners[i].qcvm_func);
+      }
     }
-    C_ProfilerEndBlock(PROFILER_BLOCK_CAMERA_UPDATE);
 
-    // TODO: should allocate a memory arena or something
-    unsigned agent_count = 0;
-    for (unsigned i = 0; i < game->entity_count; i++) {
-      unsigned signature = game->entities[i];
-
-      if (signature & agent_signature) {
-        agent_count++;
+    {
+      C_PROFILER_ZONE("Camera Update");
+      for (unsigned i = 0; i < game->current_scene->camera_update_listener_count;
+           i++) {
+        qcvm_set_parm_float(game->qcvms[0], 0, game->delta_time);
+        qcvm_run(game->qcvms[0],
+                 game->current_scene->camera_update_listeners[i].qcvm_func);
       }
     }
 
-    if (agent_count != 0) {
-      C_ProfilerStartBlock(PROFILER_BLOCK_THINK);
-      think_job_t *think_jobs = calloc(agent_count, sizeof(think_job_t));
-
-      unsigned agent_idx = 0;
-      unsigned current_batch = 0;
-
-      think_job_t batch = {
-          .game = game,
-          .agent_count = 0,
-      };
+    // Agents added by QC during the tick wait for the next one
+    unsigned *agents = game->queries[ENTITY_QUERY_AGENTS].entities;
+    unsigned agent_count = game->queries[ENTITY_QUERY_AGENTS].count;
 
-      for (unsigned i = 0; i < game->entity_count; i++) {
-        unsigned signature = game->entities[i];
+    // Each phase declares what it touches, and only waits for the ones it
+    // conflicts with. Thinking runs QC code that may change any agent or tile,
+    // so everything waits for it. Past that, path finding only writes agents
+    // and tile texts only write texts, so both run at the same time.
+    job_graph_t *graph = game->frame_graph;
+    C_JobGraphClear(graph);
 
-        if (signature & agent_signature) {
-          batch.agents[agent_idx % THINK_JOB_BATCH_AGENT_SIZE] = i;
-          batch.agent_count++;
-
-          if (agent_idx % THINK_JOB_BATCH_AGENT_SIZE == 0 && agent_idx != 0) {
-            think_jobs[current_batch] = batch;
-            C_JobSystemEnqueue(game->job_sys2, (job_t){.proc = G_WorkerThinkAgent, .data = &think_jobs[current_batch]});
-            batch.agent_count = 0;
-            current_batch++;
-          }
-          agent_idx++;
-        }
-      }
-
-      if (agent_count % THINK_JOB_BATCH_AGENT_SIZE) {
-        batch.agent_count++;
-      }
+    think_job_t think_job = {
+        .agents = agents,
+        .game = game,
+    };
+    flow_field_job_t flow_field_job = {
+        .agents = agents,
+        .agent_count = agent_count,
+        .map = game->current_scene->current_map,
+        .game = game,
+    };
+    path_request_job_t path_request_job = {
+        .agents = agents,
+        .agent_count = agent_count,
+        .map = game->current_scene->current_map,
+        .game = game,
+    };
+    path_finding_job_t path_finding_job = {
+        .agents = agents,
+        .game = game,
+        .delta = game->delta_time,
+        .map = game->current_scene->current_map,
+    };
+    item_text_job_t item_text_job = {
+        .game = game,
+    };
 
-      if (batch.agent_count != 0) {
-        think_jobs[current_batch] = batch;
-        C_JobSystemEnqueue(game->job_sys2, (job_t){.proc = G_WorkerThinkAgent, .data = &think_jobs[current_batch]});
-      }
+    unsigned think_node = JOB_GRAPH_INVALID_NODE;
+    unsigned flow_field_node = JOB_GRAPH_INVALID_NODE;
+    unsigned path_request_node = JOB_GRAPH_INVALID_NODE;
+    unsigned path_finding_node = JOB_GRAPH_INVALID_NODE;
+    unsigned tile_text_node = JOB_GRAPH_INVALID_NODE;
 
-      while (!C_JobSystemAllDone(game->job_sys2)) {
-      };
-      C_ProfilerEndBlock(PROFILER_BLOCK_THINK);
-
-      free(think_jobs);
-
-      C_ProfilerStartBlock(PROFILER_BLOCK_PATH_FINDING);
-      path_finding_job_t *path_finding_jobs = calloc(agent_count, sizeof(path_finding_job_t));
-      agent_idx = 0;
-      for (unsigned i = 0; i < game->entity_count; i++) {
-        unsigned signature = game->entities[i];
-
-        if (signature & agent_signature) {
-          path_finding_jobs[i] = (path_finding_job_t){
-              .agent = i,
-              .game = game,
-              .delta = game->delta_time,
-              .map = game->current_scene->current_map,
-          };
-          C_JobSystemEnqueue(game->job_sys2, (job_t){.proc = G_WorkerUpdateAgents, .data = &path_finding_jobs[agent_idx]});
-          agent_idx++;
-        }
+    if (agent_count != 0) {
+      think_node = C_JobGraphAddParallelFor(
+          graph, FRAME_RESOURCE_AGENTS | FRAME_RESOURCE_TILES,
+          FRAME_RESOURCE_AGENTS | FRAME_RESOURCE_TILES, 0, agent_count,
+          THINK_JOB_GRAIN, G_WorkerThinkAgent, &think_job);
+
+      // Goals crowded after thinking get a field before agents search paths
+      if (game->current_scene->current_map != -1) {
+        flow_field_node = C_JobGraphAddJob(
+            graph, FRAME_RESOURCE_AGENTS | FRAME_RESOURCE_TILES,
+            FRAME_RESOURCE_AGENTS,
+            (job_t){.proc = G_WorkerAssignFlowFields,
+                    .data = &flow_field_job,
+                    .priority = JOB_PRIORITY_CRITICAL});
+
+        // Then the other requests are searched by priority, within the budget
+        path_request_node = C_JobGraphAddJob(
+            graph, FRAME_RESOURCE_AGENTS | FRAME_RESOURCE_TILES,
+            FRAME_RESOURCE_AGENTS,
+            (job_t){.proc = G_WorkerServePathRequests,
+                    .data = &path_request_job,
+                    .priority = JOB_PRIORITY_CRITICAL});
       }
 
-      while (!C_JobSystemAllDone(game->job_sys2)) {
-      };
-
-      C_ProfilerEndBlock(PROFILER_BLOCK_PATH_FINDING);
-
-      free(path_finding_jobs);
+      path_finding_node = C_JobGraphAddParallelFor(
+          graph, FRAME_RESOURCE_AGENTS | FRAME_RESOURCE_TILES,
+          FRAME_RESOURCE_AGENTS, 0, agent_count, PATH_FINDING_JOB_GRAIN,
+          G_WorkerUpdateAgents, &path_finding_job);
     }
 
     if (game->current_scene->current_map != -1) {
-      C_ProfilerStartBlock(PROFILER_BLOCK_SETUP_TILE_TEXT);
       map_t *the_map = &game->current_scene->maps[game->current_scene->current_map];
 
-      item_text_job_t *jobs = calloc(the_map->h, sizeof(item_text_job_t));
-
-      for (unsigned row = 0; row < the_map->h; row++) {
-        jobs[row] = (item_text_job_t){
-            .row = row,
-            .game = game,
-        };
+      tile_text_node = C_JobGraphAddParallelFor(
+          graph, FRAME_RESOURCE_TILES, FRAME_RESOURCE_TEXTS, 0, the_map->h,
+          ITEM_TEXT_JOB_GRAIN, G_WorkerSetupTileText, &item_text_job);
+    }
 
-        C_JobSystemEnqueue(game->job_sys2, (job_t){.proc = G_WorkerSetupTileText, .data = &jobs[row]});
+    {
+      C_PROFILER_ZONE("Frame Graph");
+      C_JobGraphRun(graph);
+
+      // Nodes ran all over the place, account them under the graph
+      double start, end;
+      if (think_node != JOB_GRAPH_INVALID_NODE) {
+        C_JobGraphNodeTime(graph, think_node, &start, &end);
+        C_PROFILER_RECORD("Agent Thinking", start, end);
+        if (flow_field_node != JOB_GRAPH_INVALID_NODE) {
+          C_JobGraphNodeTime(graph, flow_field_node, &start, &end);
+          C_PROFILER_RECORD("Flow Fields", start, end);
+          C_JobGraphNodeTime(graph, path_request_node, &start, &end);
+          C_PROFILER_RECORD("Path Requests", start, end);
+        }
+        C_JobGraphNodeTime(graph, path_finding_node, &start, &end);
+        C_PROFILER_RECORD("Agent Movement", start, end);
+      }
+      if (tile_text_node != JOB_GRAPH_INVALID_NODE) {
+        C_JobGraphNodeTime(graph, tile_text_node, &start, &end);
+        C_PROFILER_RECORD("Setup Tile Text", start, end);
       }
-
-      while (!C_JobSystemAllDone(game->job_sys2)) {
-      };
-
-      C_ProfilerEndBlock(PROFILER_BLOCK_SETUP_TILE_TEXT);
-
-      free(jobs);
     }
 
     zpl_f64 delta = (zpl_time_rel() - game->last_time) /
@@ -518,9 +590,20 @@ game_state_t *G_TickGame(client_t *client, game_t *game) {
     }
   }
 
-  VK_TickSystems(game->rend);
+  // Each VM counts its own instructions, report what they all ran this tick
+  unsigned long qc_executed = 0;
+  for (unsigned i = 0; i < game->worker_count; i++) {
+    if (game->qcvms[i]) {
+      qc_executed += qcvm_get_executed(game->qcvms[i]);
+    }
+  }
+  C_PROFILER_COUNT("QC Instructions", qc_executed - game->qc_executed);
+  game->qc_executed = qc_executed;
 
-  C_ProfilerEndBlock(PROFILER_BLOCK_GAME_TICK);
+  {
+    C_PROFILER_ZONE("VK System Update");
+    VK_TickSystems(game->rend);
+  }
 
   return &game->state;
 }
@@ -567,14 +650,20 @@ int G_Map_Create(game_t *game, unsigned w, unsigned h) {
 
   VK_CreateMap(game->rend, w, h, game->current_scene->map_count);
 
-  // Init the same map accross all workers
-  // for (unsigned i = 0; i < game->worker_count; i++) {
-  // TODO: the jps map should be per worker
+  // Obstacles are shared, the search contexts are created by the workers when
+  // they need one
   map_t *the_map = &game->current_scene->maps[game->current_scene->map_count];
   zpl_mutex_lock(&the_map->mutex);
-  for (unsigned i = 0; i < 16; i++) {
-    the_map->jps_maps[i] = jps_create(w, h);
-  }
+  the_map->jps_grid = jps_grid_create(w, h);
+  // JPS+, walls then update the jumps of their rows and columns only
+  jps_build_jump_table(the_map->jps_grid);
+  the_map->hpa = hpa_create(the_map->jps_grid, HPA_CLUSTER_SIZE);
+  the_map->path_pool = G_PathPool_Create();
+  the_map->path_cache = G_PathCache_Create(the_map->path_pool);
+  the_map->path_index = G_PathIndex_Create(w, h);
+  the_map->flow_fields = calloc(FLOW_FIELD_SLOTS, sizeof(flow_field_t));
+  the_map->jps_maps = calloc(game->worker_count, sizeof(struct map *));
+  the_map->hpa_searches = calloc(game->worker_count, sizeof(struct hpa_search *));
   the_map->w = w;
   the_map->h = h;
   the_map->gpu_tiles = VK_GetMap(game->rend, game->current_scene->map_count);
@@ -584,7 +673,6 @@ int G_Map_Create(game_t *game, unsigned w, unsigned h) {
   // And not sure if the mapped data from the renderer is actually zeroed
   memset(the_map->gpu_tiles, 0, w * h * sizeof(struct Tile));
   zpl_mutex_unlock(&the_map->mutex);
-  // }
 
   if (game->current_scene->current_map == -1) {
     game->current_scene->current_map = game->current_scene->map_count;
@@ -1702,6 +1790,7 @@ int G_SortFoundStack(const void *a, const void *b) {
 }
 
 void G_Item_FindNearest_QC(qcvm_t *qcvm) {
+  C_PROFILER_ZONE("G_Item_FindNearest");
   game_t *game = qcvm_get_user_data(qcvm);
 
   int map = qcvm_get_parm_int(qcvm, 0);
@@ -1966,11 +2055,26 @@ void G_Entity_Goto_QC(qcvm_t *qcvm) {
   float x = qcvm_get_parm_float(qcvm, 1);
   float y = qcvm_get_parm_float(qcvm, 2);
 
+  game->cpu_agents[entity].path_priority = G_PathPriority(&game->cpu_agents[entity]);
   game->cpu_agents[entity].state = AGENT_PATH_FINDING;
   game->cpu_agents[entity].target[0] = roundf(x);
   game->cpu_agents[entity].target[1] = roundf(y);
 }
 
+void G_Path_SetBudget_QC(qcvm_t *qcvm) {
+  game_t *game = qcvm_get_user_data(qcvm);
+  float budget = qcvm_get_parm_float(qcvm, 0);
+
+  if (budget < 0.0f) {
+    printf(LOG_ERROR "Assertion G_Path_SetBudget_QC(milliseconds >= 0) "
+                     "[milliseconds = %.03f] should be verified.\n",
+           budget);
+    return;
+  }
+
+  game->path_budget = budget;
+}
+
 void G_Draw_Image_Relative_QC(qcvm_t *qcvm) {
   const char *path = qcvm_get_parm_string(qcvm, 0);
   float w = qcvm_get_parm_float(qcvm, 1);
@@ -1993,15 +2097,49 @@ void G_Scene_End(game_t *game, scene_t *scene) {
 }
 
 void G_Scene_Destroy(game_t *game, scene_t *scene) {
+  // Requests are searched on the current map, the next scene asks again. The
+  // paths of the agents go away with the pools of the maps.
+  G_PathRequests_Clear(&game->path_requests);
+  entity_query_t *agent_query = &game->queries[ENTITY_QUERY_AGENTS];
+  for (unsigned a = 0; a < agent_query->count; a++) {
+    memset(&game->cpu_agents[agent_query->entities[a]].computed_path, 0,
+           sizeof(cpu_path_t));
+  }
+
   if (scene) {
     for (unsigned m = 0; m < scene->map_count; m++) {
       map_t *the_map = &scene->maps[m];
 
-      for (unsigned i = 0; i < 16; i++) {
+      for (unsigned i = 0; the_map->jps_maps && i < game->worker_count; i++) {
         if (the_map->jps_maps[i]) {
           jps_destroy(the_map->jps_maps[i]);
         }
       }
+      free(the_map->jps_maps);
+      for (unsigned i = 0; the_map->hpa_searches && i < game->worker_count; i++) {
+        if (the_map->hpa_searches[i]) {
+          hpa_search_destroy(the_map->hpa_searches[i]);
+        }
+      }
+      free(the_map->hpa_searches);
+      if (the_map->hpa) {
+        hpa_destroy(the_map->hpa);
+      }
+      if (the_map->jps_grid) {
+        jps_grid_destroy(the_map->jps_grid);
+      }
+      if (the_map->path_cache) {
+        G_PathCache_Destroy(the_map->path_cache);
+      }
+      if (the_map->path_pool) {
+        G_PathPool_Destroy(the_map->path_pool);
+      }
+      if (the_map->path_index) {
+        G_PathIndex_Destroy(the_map->path_index);
+      }
+      if (the_map->flow_fields) {
+        G_FlowFields_Destroy(the_map->flow_fields);
+      }
 
       free(the_map->cpu_tiles);
     }
@@ -2065,24 +2203,17 @@ const vec2 offsets_3[3] = {
     {0.80, 0.76},
 };
 
-void G_WorkerSetupTileText(void *data, unsigned thread_idx) {
-  unsigned screen_width, screen_height;
-
-  item_text_job_t *the_job = data;
-
-  // worker_t *worker = the_job->worker;
-  game_t *game = the_job->game;
-  map_t *the_map = &game->current_scene->maps[game->current_scene->current_map];
-  CL_GetViewDim(game->client, &screen_width, &screen_height);
-
+void G_WorkerSetupTileRow(game_t *game, map_t *the_map, unsigned row,
+                          unsigned screen_width, unsigned screen_height) {
   char amount_str[256];
+  unsigned quads = 0;
 
   for (unsigned col = 0; col < the_map->w; col++) {
-    unsigned idx = the_job->row * the_map->w + col;
+    unsigned idx = row * the_map->w + col;
 
     cpu_tile_t *the_tile = &the_map->cpu_tiles[idx];
 
-    vec4 tile_pos = {(float)col, (float)the_job->row, 0.0f, 1.0f};
+    vec4 tile_pos = {(float)col, (float)row, 0.0f, 1.0f};
     vec4 screen_space;
 
     const vec2 *offsets = NULL;
@@ -2099,7 +2230,7 @@ void G_WorkerSetupTileText(void *data, unsigned thread_idx) {
     } else if (the_tile->stack_count == 3) {
       offsets = offsets_3;
     } else {
-      printf(LOG_ERROR "G_WorkerSetupTileText assumes there is at most 3 stacks per tile. Stack count is %d on (%d,%d).\n", the_tile->stack_count, col, the_job->row);
+      printf(LOG_ERROR "G_WorkerSetupTileText assumes there is at most 3 stacks per tile. Stack count is %d on (%d,%d).\n", the_tile->stack_count, col, row);
     }
 
     for (unsigned i = 0; i < the_tile->stack_count; i++) {
@@ -2126,6 +2257,7 @@ void G_WorkerSetupTileText(void *data, unsigned thread_idx) {
         float max_height = 0.0f;
         int background_idx = atomic_fetch_add_explicit(&game->state.text_count,
                                                        1, memory_order_relaxed);
+        quads += len + 1;
 
         // Digits
         for (unsigned cc = 0; cc < len; cc++) {
@@ -2172,6 +2304,23 @@ void G_WorkerSetupTileText(void *data, unsigned thread_idx) {
       }
     }
   }
+
+  C_PROFILER_COUNT("Text Quads", quads);
+}
+
+void G_WorkerSetupTileText(void *data, unsigned begin, unsigned end,
+                           unsigned thread_idx) {
+  unsigned screen_width, screen_height;
+
+  item_text_job_t *the_job = data;
+
+  game_t *game = the_job->game;
+  map_t *the_map = &game->current_scene->maps[game->current_scene->current_map];
+  CL_GetViewDim(game->client, &screen_width, &screen_height);
+
+  for (unsigned row = begin; row < end; row++) {
+    G_WorkerSetupTileRow(game, the_map, row, screen_width, screen_height);
+  }
 }
 
 void G_WorkerLoadFont(void *data, unsigned thread_idx) {
@@ -2319,6 +2468,11 @@ void G_Load_Game(game_t *game) {
   CL_SetClientState(game->client, CLIENT_LOADING);
   zpl_f64 now = zpl_time_rel();
 
+  // Every loading job is accounted here, the loading scene keeps being ticked
+  // until it drops to zero. They run in the background, so the ticks in
+  // between don't wait on them.
+  job_counter_t loading = {0};
+
   // Load the default texture, that'll have a null index (index == 0)
   // So, everytime there is an error, it'll be displayed
   // WARNING: kinda weeb stuff
@@ -2345,10 +2499,8 @@ void G_Load_Game(game_t *game) {
       .path = "../source/resources/InterDisplay-ExtraBold.ttf",
   };
 
-  C_JobSystemEnqueue(game->job_sys2, (job_t){
-                                         .proc = G_WorkerLoadFont, .data = &font_job_console});
-  C_JobSystemEnqueue(game->job_sys2, (job_t){
-                                         .proc = G_WorkerLoadFont, .data = &font_job_game});
+  C_JobSystemEnqueue(game->job_sys2, (job_t){.proc = G_WorkerLoadFont, .data = &font_job_console, .counter = &loading, .priority = JOB_PRIORITY_BACKGROUND});
+  C_JobSystemEnqueue(game->job_sys2, (job_t){.proc = G_WorkerLoadFont, .data = &font_job_game, .counter = &loading, .priority = JOB_PRIORITY_BACKGROUND});
 
   texture_job_t *texture_jobs =
       calloc(zpl_array_count(game->material_bank.entries) * 3 +
@@ -2384,9 +2536,9 @@ void G_Load_Game(game_t *game) {
         .path = mat->full_stack_path,
     };
 
-    C_JobSystemEnqueue(game->job_sys2, (job_t){.proc = G_WorkerLoadTexture, .data = low_stack_job});
-    C_JobSystemEnqueue(game->job_sys2, (job_t){.proc = G_WorkerLoadTexture, .data = half_stack_job});
-    C_JobSystemEnqueue(game->job_sys2, (job_t){.proc = G_WorkerLoadTexture, .data = full_stack_job});
+    C_JobSystemEnqueue(game->job_sys2, (job_t){.proc = G_WorkerLoadTexture, .data = low_stack_job, .counter = &loading, .priority = JOB_PRIORITY_BACKGROUND});
+    C_JobSystemEnqueue(game->job_sys2, (job_t){.proc = G_WorkerLoadTexture, .data = half_stack_job, .counter = &loading, .priority = JOB_PRIORITY_BACKGROUND});
+    C_JobSystemEnqueue(game->job_sys2, (job_t){.proc = G_WorkerLoadTexture, .data = full_stack_job, .counter = &loading, .priority = JOB_PRIORITY_BACKGROUND});
   }
 
   unsigned offset = zpl_array_count(game->material_bank.entries) * 3;
@@ -2508,22 +2660,22 @@ void G_Load_Game(game_t *game) {
         .path = wall->nothing_path,
     };
 
-    C_JobSystemEnqueue(game->job_sys2, (job_t){.proc = G_WorkerLoadTexture, .data = only_left_job});
-    C_JobSystemEnqueue(game->job_sys2, (job_t){.proc = G_WorkerLoadTexture, .data = only_right_job});
-    C_JobSystemEnqueue(game->job_sys2, (job_t){.proc = G_WorkerLoadTexture, .data = only_top_job});
-    C_JobSystemEnqueue(game->job_sys2, (job_t){.proc = G_WorkerLoadTexture, .data = only_bottom_job});
-    C_JobSystemEnqueue(game->job_sys2, (job_t){.proc = G_WorkerLoadTexture, .data = all_job});
-    C_JobSystemEnqueue(game->job_sys2, (job_t){.proc = G_WorkerLoadTexture, .data = left_right_bottom_job});
-    C_JobSystemEnqueue(game->job_sys2, (job_t){.proc = G_WorkerLoadTexture, .data = left_right_job});
-    C_JobSystemEnqueue(game->job_sys2, (job_t){.proc = G_WorkerLoadTexture, .data = left_right_top_job});
-    C_JobSystemEnqueue(game->job_sys2, (job_t){.proc = G_WorkerLoadTexture, .data = top_bottom_job});
-    C_JobSystemEnqueue(game->job_sys2, (job_t){.proc = G_WorkerLoadTexture, .data = right_top_job});
-    C_JobSystemEnqueue(game->job_sys2, (job_t){.proc = G_WorkerLoadTexture, .data = left_top_job});
-    C_JobSystemEnqueue(game->job_sys2, (job_t){.proc = G_WorkerLoadTexture, .data = right_bottom_job});
-    C_JobSystemEnqueue(game->job_sys2, (job_t){.proc = G_WorkerLoadTexture, .data = left_bottom_job});
-    C_JobSystemEnqueue(game->job_sys2, (job_t){.proc = G_WorkerLoadTexture, .data = left_top_bottom_job});
-    C_JobSystemEnqueue(game->job_sys2, (job_t){.proc = G_WorkerLoadTexture, .data = right_top_bottom_job});
-    C_JobSystemEnqueue(game->job_sys2, (job_t){.proc = G_WorkerLoadTexture, .data = nothing_job});
+    C_JobSystemEnqueue(game->job_sys2, (job_t){.proc = G_WorkerLoadTexture, .data = only_left_job, .counter = &loading, .priority = JOB_PRIORITY_BACKGROUND});
+    C_JobSystemEnqueue(game->job_sys2, (job_t){.proc = G_WorkerLoadTexture, .data = only_right_job, .counter = &loading, .priority = JOB_PRIORITY_BACKGROUND});
+    C_JobSystemEnqueue(game->job_sys2, (job_t){.proc = G_WorkerLoadTexture, .data = only_top_job, .counter = &loading, .priority = JOB_PRIORITY_BACKGROUND});
+    C_JobSystemEnqueue(game->job_sys2, (job_t){.proc = G_WorkerLoadTexture, .data = only_bottom_job, .counter = &loading, .priority = JOB_PRIORITY_BACKGROUND});
+    C_JobSystemEnqueue(game->job_sys2, (job_t){.proc = G_WorkerLoadTexture, .data = all_job, .counter = &loading, .priority = JOB_PRIORITY_BACKGROUND});
+    C_JobSystemEnqueue(game->job_sys2, (job_t){.proc = G_WorkerLoadTexture, .data = left_right_bottom_job, .counter = &loading, .priority = JOB_PRIORITY_BACKGROUND});
+    C_JobSystemEnqueue(game->job_sys2, (job_t){.proc = G_WorkerLoadTexture, .data = left_right_job, .counter = &loading, .priority = JOB_PRIORITY_BACKGROUND});
+    C_JobSystemEnqueue(game->job_sys2, (job_t){.proc = G_WorkerLoadTexture, .data = left_right_top_job, .counter = &loading, .priority = JOB_PRIORITY_BACKGROUND});
+    C_JobSystemEnqueue(game->job_sys2, (job_t){.proc = G_WorkerLoadTexture, .data = top_bottom_job, .counter = &loading, .priority = JOB_PRIORITY_BACKGROUND});
+    C_JobSystemEnqueue(game->job_sys2, (job_t){.proc = G_WorkerLoadTexture, .data = right_top_job, .counter = &loading, .priority = JOB_PRIORITY_BACKGROUND});
+    C_JobSystemEnqueue(game->job_sys2, (job_t){.proc = G_WorkerLoadTexture, .data = left_top_job, .counter = &loading, .priority = JOB_PRIORITY_BACKGROUND});
+    C_JobSystemEnqueue(game->job_sys2, (job_t){.proc = G_WorkerLoadTexture, .data = right_bottom_job, .counter = &loading, .priority = JOB_PRIORITY_BACKGROUND});
+    C_JobSystemEnqueue(game->job_sys2, (job_t){.proc = G_WorkerLoadTexture, .data = left_bottom_job, .counter = &loading, .priority = JOB_PRIORITY_BACKGROUND});
+    C_JobSystemEnqueue(game->job_sys2, (job_t){.proc = G_WorkerLoadTexture, .data = left_top_bottom_job, .counter = &loading, .priority = JOB_PRIORITY_BACKGROUND});
+    C_JobSystemEnqueue(game->job_sys2, (job_t){.proc = G_WorkerLoadTexture, .data = right_top_bottom_job, .counter = &loading, .priority = JOB_PRIORITY_BACKGROUND});
+    C_JobSystemEnqueue(game->job_sys2, (job_t){.proc = G_WorkerLoadTexture, .data = nothing_job, .counter = &loading, .priority = JOB_PRIORITY_BACKGROUND});
   }
 
   offset += zpl_array_count(game->wall_bank.entries) * 16;
@@ -2554,9 +2706,9 @@ void G_Load_Game(game_t *game) {
         .path = terrain->variant3_path,
     };
 
-    C_JobSystemEnqueue(game->job_sys2, (job_t){.proc = G_WorkerLoadTexture, .data = variant1_job});
-    C_JobSystemEnqueue(game->job_sys2, (job_t){.proc = G_WorkerLoadTexture, .data = variant2_job});
-    C_JobSystemEnqueue(game->job_sys2, (job_t){.proc = G_WorkerLoadTexture, .data = variant3_job});
+    C_JobSystemEnqueue(game->job_sys2, (job_t){.proc = G_WorkerLoadTexture, .data = variant1_job, .counter = &loading, .priority = JOB_PRIORITY_BACKGROUND});
+    C_JobSystemEnqueue(game->job_sys2, (job_t){.proc = G_WorkerLoadTexture, .data = variant2_job, .counter = &loading, .priority = JOB_PRIORITY_BACKGROUND});
+    C_JobSystemEnqueue(game->job_sys2, (job_t){.proc = G_WorkerLoadTexture, .data = variant3_job, .counter = &loading, .priority = JOB_PRIORITY_BACKGROUND});
   }
 
   offset += zpl_array_count(game->terrain_bank.entries) * 3;
@@ -2587,9 +2739,9 @@ void G_Load_Game(game_t *game) {
         .path = pawn->east_path,
     };
 
-    C_JobSystemEnqueue(game->job_sys2, (job_t){.proc = G_WorkerLoadTexture, .data = north_job});
-    C_JobSystemEnqueue(game->job_sys2, (job_t){.proc = G_WorkerLoadTexture, .data = south_job});
-    C_JobSystemEnqueue(game->job_sys2, (job_t){.proc = G_WorkerLoadTexture, .data = east_job});
+    C_JobSystemEnqueue(game->job_sys2, (job_t){.proc = G_WorkerLoadTexture, .data = north_job, .counter = &loading, .priority = JOB_PRIORITY_BACKGROUND});
+    C_JobSystemEnqueue(game->job_sys2, (job_t){.proc = G_WorkerLoadTexture, .data = south_job, .counter = &loading, .priority = JOB_PRIORITY_BACKGROUND});
+    C_JobSystemEnqueue(game->job_sys2, (job_t){.proc = G_WorkerLoadTexture, .data = east_job, .counter = &loading, .priority = JOB_PRIORITY_BACKGROUND});
   }
 
   offset += zpl_array_count(game->pawn_bank.entries) * 3;
@@ -2606,13 +2758,16 @@ void G_Load_Game(game_t *game) {
         .game = game,
     };
 
-    C_JobSystemEnqueue(game->job_sys2, (job_t){.proc = G_WorkerLoadTexture, .data = job});
+    C_JobSystemEnqueue(game->job_sys2, (job_t){.proc = G_WorkerLoadTexture, .data = job, .counter = &loading, .priority = JOB_PRIORITY_BACKGROUND});
   }
 
-  while (!C_JobSystemAllDone(game->job_sys2)) {
+  while (!C_JobCounterDone(&loading)) {
     game_state_t *state = G_TickGame(game->client, game);
 
     CL_DrawClient(game->client, game, state);
+    // Loading frames are frames too, and the zones recorded by the workers are
+    // only drained from their rings there
+    C_ProfilerFrameEnd();
   }
 
   VK_UploadMapTextures(game->rend, game->map_textures, game->map_texture_count);
@@ -2932,9 +3087,9 @@ void G_Entity_GetInventoryAmount_QC(qcvm_t *qcvm) {
   unsigned entity = qcvm_get_parm_int(qcvm, 0);
   const char *recipe = qcvm_get_parm_string(qcvm, 1);
 
-  if (game->cpu_agents[entity].inventory_initialized) {
+  if (game->agent_inventories[entity].initialized) {
     zpl_u64 key = zpl_fnv64(recipe, strlen(recipe));
-    float *amount = G_Inventory_get(&game->cpu_agents[entity].inventory, key);
+    float *amount = G_Inventory_get(&game->agent_inventories[entity].items, key);
 
     if (!amount) {
       qcvm_return_float(qcvm, 0.0f);
@@ -2953,9 +3108,9 @@ void G_Entity_RemoveInventoryAmount_QC(qcvm_t *qcvm) {
   const char *recipe = qcvm_get_parm_string(qcvm, 1);
   float amount = qcvm_get_parm_float(qcvm, 2);
 
-  if (game->cpu_agents[entity].inventory_initialized) {
+  if (game->agent_inventories[entity].initialized) {
     zpl_u64 key = zpl_fnv64(recipe, strlen(recipe));
-    float *current_amount = G_Inventory_get(&game->cpu_agents[entity].inventory, key);
+    float *current_amount = G_Inventory_get(&game->agent_inventories[entity].items, key);
 
     if (amount) {
       (*current_amount) -= glm_min(*current_amount, amount);
@@ -2972,16 +3127,16 @@ void G_Entity_AddInventoryAmount_QC(qcvm_t *qcvm) {
 
   zpl_u64 key = zpl_fnv64(recipe, strlen(recipe));
 
-  if (!game->cpu_agents[entity].inventory_initialized) {
-    G_Inventory_init(&game->cpu_agents[entity].inventory, zpl_heap_allocator());
-    game->cpu_agents[entity].inventory_initialized = true;
+  if (!game->agent_inventories[entity].initialized) {
+    G_Inventory_init(&game->agent_inventories[entity].items, zpl_heap_allocator());
+    game->agent_inventories[entity].initialized = true;
   }
 
-  float *current_amount = G_Inventory_get(&game->cpu_agents[entity].inventory, key);
+  float *current_amount = G_Inventory_get(&game->agent_inventories[entity].items, key);
 
   if (!current_amount) {
-    G_Inventory_set(&game->cpu_agents[entity].inventory, key, 0.0f);
-    current_amount = G_Inventory_get(&game->cpu_agents[entity].inventory, key);
+    G_Inventory_set(&game->agent_inventories[entity].items, key, 0.0f);
+    current_amount = G_Inventory_get(&game->agent_inventories[entity].items, key);
   }
 
   (*current_amount) += amount;
@@ -3202,6 +3357,13 @@ void G_QCVMInstall(qcvm_t *qcvm) {
       .args[2] = {.name = "y", .type = QCVM_FLOAT},
   };
 
+  qcvm_export_t export_G_Path_SetBudget = {
+      .func = G_Path_SetBudget_QC,
+      .name = "G_Path_SetBudget",
+      .argc = 1,
+      .args[0] = {.name = "milliseconds", .type = QCVM_FLOAT},
+  };
+
   qcvm_export_t export_G_Entity_GetPosition = {
       .func = G_Entity_GetPosition_QC,
       .name = "G_Entity_GetPosition",
@@ -3262,6 +3424,7 @@ void G_QCVMInstall(qcvm_t *qcvm) {
   qcvm_add_export(qcvm, &export_G_NeutralAnimal_Add);
   qcvm_add_export(qcvm, &export_G_Colonist_Add);
   qcvm_add_export(qcvm, &export_G_Entity_Goto);
+  qcvm_add_export(qcvm, &export_G_Path_SetBudget);
   qcvm_add_export(qcvm, &export_G_Entity_GetPosition);
   qcvm_add_export(qcvm, &export_G_Entity_GetInventoryAmount);
   qcvm_add_export(qcvm, &export_G_Entity_RemoveInventoryAmount);
@@ -3326,18 +3489,29 @@ bool G_Load(client_t *client, game_t *game) {
   return true;
 }
 
+// File the new entity in every query it matches
+static void G_Queries_Add(game_t *game, unsigned entity, unsigned signature) {
+  for (unsigned q = 0; q < ENTITY_QUERY_COUNT; q++) {
+    entity_query_t *query = &game->queries[q];
+    if ((signature & query->signature) == query->signature) {
+      query->entities[query->count++] = entity;
+    }
+  }
+}
+
 void G_AddFurniture(client_t *client, game_t *game, struct Transform *transform,
                     struct Sprite *sprite, struct Immovable *immovable) {
   vk_rend_t *rend = game->rend;
-  int entity =
-      VK_Add_Entity(rend, transform_signature | model_transform_signature |
-                              sprite_signature | immovable_signature);
+  unsigned signature = transform_signature | model_transform_signature |
+                       sprite_signature | immovable_signature;
+  int entity = VK_Add_Entity(rend, signature);
 
   if (entity == -1) {
     return;
   }
 
   game->entity_count += 1;
+  G_Queries_Add(game, entity, signature);
 
   VK_Add_Transform(rend, entity, transform);
   VK_Add_Model_Transform(rend, entity, NULL);
@@ -3348,9 +3522,9 @@ void G_AddFurniture(client_t *client, game_t *game, struct Transform *transform,
 void G_AddPawn(game_t *game, struct Transform *transform,
                struct Sprite *sprite, agent_type_t agent_type) {
   vk_rend_t *rend = game->rend;
-  int entity =
-      VK_Add_Entity(rend, transform_signature | model_transform_signature |
-                              agent_signature | sprite_signature);
+  unsigned signature = transform_signature | model_transform_signature |
+                       agent_signature | sprite_signature;
+  int entity = VK_Add_Entity(rend, signature);
 
   if (entity == -1) {
     return;
@@ -3373,7 +3547,9 @@ void G_AddPawn(game_t *game, struct Transform *transform,
       .target = {},
   };
 
+  cpu_agent.path_priority = G_PathPriority(&cpu_agent);
   game->cpu_agents[entity] = cpu_agent;
+  G_Queries_Add(game, entity, signature);
 
   VK_Add_Transform(rend, entity, transform);
   VK_Add_Model_Transform(rend, entity, NULL);
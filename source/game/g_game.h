@@ -236,7 +236,7 @@ void G_DestroyGame(game_t *game);
 
 bool G_Load(client_t *client, game_t *game);
 
-void G_Rectangle(ivec2 start, ivec2 end, int *indices, int *count);
+void G_Rectangle(ivec2 start, ivec2 end, int width, int *indices, int *count);
 
 character_t *G_GetCharacter(game_t *game, const char *family, wchar_t c);
 
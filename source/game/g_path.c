@@ -0,0 +1,1156 @@
+#include <common/c_job.h>
+#include <common/c_profiler.h>
+#include <common/c_terminal.h>
+#include <game/g_private.h>
+#include <hpa.h>
+#include <intlist.h>
+#include <jps.h>
+#include <limits.h>
+#include <string.h>
+
+path_pool_t *G_PathPool_Create(void) {
+  path_pool_t *pool = calloc(1, sizeof(path_pool_t));
+
+  zpl_mutex_init(&pool->mutex);
+  pool->free_list = PATH_POOL_NONE;
+
+  return pool;
+}
+
+void G_PathPool_Destroy(path_pool_t *pool) {
+  for (unsigned c = 0; c < pool->chunk_count; c++) {
+    free(pool->chunks[c]);
+  }
+
+  zpl_mutex_destroy(&pool->mutex);
+  free(pool);
+}
+
+static inline path_block_t *G_PathPool_Block(path_pool_t *pool, int block) {
+  return &pool->chunks[block / PATH_POOL_CHUNK_BLOCKS][block % PATH_POOL_CHUNK_BLOCKS];
+}
+
+static unsigned G_PathPool_BlockCount(unsigned count) {
+  return (count + PATH_BLOCK_POINTS - 1) / PATH_BLOCK_POINTS;
+}
+
+// Chain of blocks for `count` points, held once by the caller. Return the first
+// block + 1, or 0 when the pool is full.
+static unsigned G_PathPool_Alloc(path_pool_t *pool, unsigned count) {
+  unsigned blocks = G_PathPool_BlockCount(count);
+
+  zpl_mutex_lock(&pool->mutex);
+  if (pool->used + blocks > PATH_POOL_CHUNKS * PATH_POOL_CHUNK_BLOCKS) {
+    zpl_mutex_unlock(&pool->mutex);
+    printf(LOG_ERROR "The path pool is full (%d blocks), a path is dropped.\n",
+           PATH_POOL_CHUNKS * PATH_POOL_CHUNK_BLOCKS);
+    return 0;
+  }
+
+  int head = PATH_POOL_NONE;
+  int *link = &head;
+  for (unsigned b = 0; b < blocks; b++) {
+    if (pool->free_list == PATH_POOL_NONE) {
+      // The chunk joins the free list in order, paths stay mostly contiguous
+      path_block_t *chunk = malloc(PATH_POOL_CHUNK_BLOCKS * sizeof(path_block_t));
+      int first = pool->chunk_count * PATH_POOL_CHUNK_BLOCKS;
+      for (int i = 0; i < PATH_POOL_CHUNK_BLOCKS; i++) {
+        chunk[i].next = i + 1 < PATH_POOL_CHUNK_BLOCKS ? first + i + 1 : PATH_POOL_NONE;
+      }
+      pool->chunks[pool->chunk_count++] = chunk;
+      pool->free_list = first;
+    }
+
+    int block = pool->free_list;
+    pool->free_list = G_PathPool_Block(pool, block)->next;
+    *link = block;
+    link = &G_PathPool_Block(pool, block)->next;
+  }
+  *link = PATH_POOL_NONE;
+  pool->used += blocks;
+  zpl_mutex_unlock(&pool->mutex);
+
+  atomic_init(&G_PathPool_Block(pool, head)->refs, 1);
+  return head + 1;
+}
+
+static void G_PathPool_Retain(path_pool_t *pool, unsigned path) {
+  atomic_fetch_add(&G_PathPool_Block(pool, path - 1)->refs, 1);
+}
+
+static void G_PathPool_Unref(path_pool_t *pool, unsigned path) {
+  path_block_t *head = G_PathPool_Block(pool, path - 1);
+  if (atomic_fetch_sub(&head->refs, 1) != 1) {
+    return;
+  }
+
+  zpl_mutex_lock(&pool->mutex);
+  int last = path - 1;
+  unsigned blocks = 1;
+  while (G_PathPool_Block(pool, last)->next != PATH_POOL_NONE) {
+    last = G_PathPool_Block(pool, last)->next;
+    blocks++;
+  }
+  G_PathPool_Block(pool, last)->next = pool->free_list;
+  pool->free_list = path - 1;
+  pool->used -= blocks;
+  zpl_mutex_unlock(&pool->mutex);
+}
+
+void G_Path_Release(cpu_path_t *path) {
+  if (path->head) {
+    G_PathPool_Unref(path->pool, path->head);
+  }
+  path->head = 0;
+  path->count = 0;
+  path->current = 0;
+}
+
+// Take a reference of the path held by somebody else, or of a new one
+static void G_Path_Set(cpu_path_t *path, path_pool_t *pool, unsigned head,
+                       unsigned count) {
+  path->pool = pool;
+  path->head = head;
+  path->block = head - 1;
+  path->count = head ? count : 0;
+  path->current = 0;
+}
+
+void G_Path_Point(cpu_path_t *path, vec2 point) {
+  path_block_t *block = G_PathPool_Block(path->pool, path->block);
+  glm_vec2(block->points[path->current % PATH_BLOCK_POINTS], point);
+}
+
+void G_Path_Advance(cpu_path_t *path) {
+  path->current++;
+  if (path->current % PATH_BLOCK_POINTS == 0 && path->current < path->count) {
+    path->block = G_PathPool_Block(path->pool, path->block)->next;
+  }
+}
+
+path_cache_t *G_PathCache_Create(path_pool_t *pool) {
+  path_cache_t *cache = calloc(1, sizeof(path_cache_t));
+
+  zpl_mutex_init(&cache->mutex);
+  cache->pool = pool;
+
+  for (unsigned i = 0; i < PATH_CACHE_BUCKETS; i++) {
+    cache->buckets[i] = PATH_CACHE_NONE;
+  }
+
+  // Every entry starts in the free list
+  for (unsigned i = 0; i < PATH_CACHE_ENTRIES; i++) {
+    cache->entries[i].chain = i + 1 < PATH_CACHE_ENTRIES ? (int)i + 1 : PATH_CACHE_NONE;
+  }
+  cache->free_list = 0;
+  cache->lru_head = PATH_CACHE_NONE;
+  cache->lru_tail = PATH_CACHE_NONE;
+
+  return cache;
+}
+
+// The pool goes away with the map, paths are not given back
+void G_PathCache_Destroy(path_cache_t *cache) {
+  zpl_mutex_destroy(&cache->mutex);
+  free(cache);
+}
+
+static unsigned G_PathCache_Bucket(int start, int end) {
+  uint32_t h = (uint32_t)start * 0x9e3779b1u ^ (uint32_t)end * 0x85ebca77u;
+  return (h ^ (h >> 15)) & (PATH_CACHE_BUCKETS - 1);
+}
+
+static void G_PathCache_Unlink(path_cache_t *cache, int idx) {
+  path_cache_entry_t *entry = &cache->entries[idx];
+
+  if (entry->prev != PATH_CACHE_NONE) {
+    cache->entries[entry->prev].next = entry->next;
+  } else {
+    cache->lru_head = entry->next;
+  }
+  if (entry->next != PATH_CACHE_NONE) {
+    cache->entries[entry->next].prev = entry->prev;
+  } else {
+    cache->lru_tail = entry->prev;
+  }
+}
+
+static void G_PathCache_PushFront(path_cache_t *cache, int idx) {
+  path_cache_entry_t *entry = &cache->entries[idx];
+
+  entry->prev = PATH_CACHE_NONE;
+  entry->next = cache->lru_head;
+  if (cache->lru_head != PATH_CACHE_NONE) {
+    cache->entries[cache->lru_head].prev = idx;
+  } else {
+    cache->lru_tail = idx;
+  }
+  cache->lru_head = idx;
+}
+
+static void G_PathCache_Remove(path_cache_t *cache, int idx) {
+  path_cache_entry_t *entry = &cache->entries[idx];
+
+  int *link = &cache->buckets[G_PathCache_Bucket(entry->start, entry->end)];
+  while (*link != idx) {
+    link = &cache->entries[*link].chain;
+  }
+  *link = entry->chain;
+
+  G_PathCache_Unlink(cache, idx);
+
+  if (entry->path) {
+    cache->bytes -= G_PathPool_BlockCount(entry->count) * sizeof(path_block_t);
+    G_PathPool_Unref(cache->pool, entry->path);
+  }
+  entry->path = 0;
+  entry->count = 0;
+
+  entry->chain = cache->free_list;
+  cache->free_list = idx;
+}
+
+// Entries searched or waited for can't go away
+static bool G_PathCache_Evictable(path_cache_entry_t *entry) {
+  return !entry->pending && entry->users == 0;
+}
+
+// Drop the least recently used entries until the points fit in the budget, or
+// until one entry is free when `need_entry` is set
+static void G_PathCache_Evict(path_cache_t *cache, bool need_entry) {
+  int idx = cache->lru_tail;
+  while (idx != PATH_CACHE_NONE &&
+         (cache->bytes > PATH_CACHE_MAX_BYTES ||
+          (need_entry && cache->free_list == PATH_CACHE_NONE))) {
+    int prev = cache->entries[idx].prev;
+    if (G_PathCache_Evictable(&cache->entries[idx])) {
+      G_PathCache_Remove(cache, idx);
+    }
+    idx = prev;
+  }
+}
+
+// Walking the bucket also gets rid of the paths computed before the last wall
+// change, nobody will ask for them again
+static int G_PathCache_Find(path_cache_t *cache, int start, int end,
+                            unsigned revision) {
+  int idx = cache->buckets[G_PathCache_Bucket(start, end)];
+  while (idx != PATH_CACHE_NONE) {
+    path_cache_entry_t *entry = &cache->entries[idx];
+    int chain = entry->chain;
+
+    if (entry->revision != revision) {
+      if (G_PathCache_Evictable(entry)) {
+        G_PathCache_Remove(cache, idx);
+      }
+    } else if (entry->start == start && entry->end == end && !entry->dropped) {
+      return idx;
+    }
+
+    idx = chain;
+  }
+
+  return PATH_CACHE_NONE;
+}
+
+static int G_PathCache_Insert(path_cache_t *cache, int start, int end,
+                              unsigned revision) {
+  if (cache->free_list == PATH_CACHE_NONE) {
+    G_PathCache_Evict(cache, true);
+    if (cache->free_list == PATH_CACHE_NONE) {
+      return PATH_CACHE_NONE;
+    }
+  }
+
+  int idx = cache->free_list;
+  path_cache_entry_t *entry = &cache->entries[idx];
+  cache->free_list = entry->chain;
+
+  entry->start = start;
+  entry->end = end;
+  entry->revision = revision;
+  entry->path = 0;
+  entry->count = 0;
+  entry->pending = true;
+  entry->dropped = false;
+  entry->users = 0;
+  atomic_store(&entry->done.value, 1);
+
+  unsigned bucket = G_PathCache_Bucket(start, end);
+  entry->chain = cache->buckets[bucket];
+  cache->buckets[bucket] = idx;
+
+  G_PathCache_PushFront(cache, idx);
+
+  return idx;
+}
+
+// Search on the scratch of the calling thread, through the clusters when the
+// ends are far apart. The points land in the pool, held once for the caller.
+// Return the number of points, 0 when unreachable. `path` is left to 0 with
+// points found when the pool is full.
+static unsigned G_SearchPath(game_t *game, map_t *map, unsigned thread_idx,
+                             int start[2], int end[2], unsigned *path) {
+  C_PROFILER_ZONE("Path Search");
+
+  // Only this thread touches its slots
+  if (!map->jps_maps[thread_idx]) {
+    map->jps_maps[thread_idx] = jps_create(map->jps_grid);
+    map->hpa_searches[thread_idx] = hpa_search_create(map->hpa);
+  }
+  struct map *jps_map = map->jps_maps[thread_idx];
+  struct hpa_search *hpa_search = map->hpa_searches[thread_idx];
+
+  // Ends on a wall are refused, the scratch would keep the previous ones
+  if (jps_set_start(jps_map, start[0], start[1]) ||
+      jps_set_end(jps_map, end[0], end[1])) {
+    *path = 0;
+    C_PROFILER_COUNT("Paths Unreachable", 1);
+    return 0;
+  }
+
+  IntList *list = game->frame_memory[thread_idx].path_list;
+  il_clear(list);
+  hpa_path_finding(hpa_search, jps_map, 2, list);
+  C_PROFILER_COUNT("HPA Entrances Expanded", hpa_search->expanded);
+  C_PROFILER_COUNT("JPS Nodes Expanded", hpa_search->refined);
+
+  unsigned size = il_size(list);
+  if (!size) {
+    *path = 0;
+    C_PROFILER_COUNT("Paths Unreachable", 1);
+    return 0;
+  }
+  *path = G_PathPool_Alloc(map->path_pool, size);
+  if (!*path) {
+    C_PROFILER_COUNT("Paths Dropped", 1);
+    return size;
+  }
+  C_PROFILER_COUNT("Paths Solved", 1);
+
+  // The search leaves the waypoints from the end to the start
+  path_block_t *block = G_PathPool_Block(map->path_pool, *path - 1);
+  for (unsigned p = 0; p < size; p++) {
+    if (p != 0 && p % PATH_BLOCK_POINTS == 0) {
+      block = G_PathPool_Block(map->path_pool, block->next);
+    }
+    block->points[p % PATH_BLOCK_POINTS][0] = il_get(list, (size - p - 1), 0);
+    block->points[p % PATH_BLOCK_POINTS][1] = il_get(list, (size - p - 1), 1);
+  }
+
+  return size;
+}
+
+bool G_Map_FindPath(game_t *game, map_t *map, unsigned thread_idx, vec2 start,
+                    vec2 end, cpu_path_t *path) {
+  G_Path_Release(path);
+
+  int from[2] = {start[0], start[1]};
+  int to[2] = {end[0], end[1]};
+  if (from[0] < 0 || from[1] < 0 || from[0] >= (int)map->w || from[1] >= (int)map->h ||
+      to[0] < 0 || to[1] < 0 || to[0] >= (int)map->w || to[1] >= (int)map->h) {
+    return false;
+  }
+  int from_idx = from[1] * (int)map->w + from[0];
+  int to_idx = to[1] * (int)map->w + to[0];
+
+  // Walls only change while no path is searched, see G_Map_AddWall
+  unsigned revision = map->jps_grid->revision;
+
+  path_cache_t *cache = map->path_cache;
+  zpl_mutex_lock(&cache->mutex);
+
+  int idx = G_PathCache_Find(cache, from_idx, to_idx, revision);
+  if (idx != PATH_CACHE_NONE) {
+    path_cache_entry_t *entry = &cache->entries[idx];
+
+    if (entry->pending) {
+      // Somebody is searching the same path right now, help with the other
+      // jobs until it's done
+      C_PROFILER_COUNT("Path Cache Coalesced", 1);
+      entry->users++;
+      zpl_mutex_unlock(&cache->mutex);
+
+      C_JobSystemWait(game->job_sys2, &entry->done);
+
+      zpl_mutex_lock(&cache->mutex);
+      entry->users--;
+
+      if (entry->dropped) {
+        // The last one out frees the entry, see below
+        if (entry->users == 0) {
+          G_PathCache_Remove(cache, idx);
+        }
+        zpl_mutex_unlock(&cache->mutex);
+        return false;
+      }
+    } else {
+      C_PROFILER_COUNT("Path Cache Hits", 1);
+      G_PathCache_Unlink(cache, idx);
+      G_PathCache_PushFront(cache, idx);
+    }
+
+    // Shared with the entry, no copy
+    if (entry->path) {
+      G_PathPool_Retain(map->path_pool, entry->path);
+    }
+    G_Path_Set(path, map->path_pool, entry->path, entry->count);
+    zpl_mutex_unlock(&cache->mutex);
+
+    return path->head != 0;
+  }
+
+  C_PROFILER_COUNT("Path Cache Misses", 1);
+  idx = G_PathCache_Insert(cache, from_idx, to_idx, revision);
+  zpl_mutex_unlock(&cache->mutex);
+
+  unsigned found;
+  unsigned count = G_SearchPath(game, map, thread_idx, from, to, &found);
+  G_Path_Set(path, map->path_pool, found, count);
+
+  // Every entry is busy, the path just isn't cached
+  if (idx == PATH_CACHE_NONE) {
+    return found != 0;
+  }
+
+  zpl_mutex_lock(&cache->mutex);
+  path_cache_entry_t *entry = &cache->entries[idx];
+  if (found) {
+    G_PathPool_Retain(map->path_pool, found);
+    entry->path = found;
+    entry->count = count;
+    cache->bytes += G_PathPool_BlockCount(count) * sizeof(path_block_t);
+  }
+  entry->pending = false;
+  // Only failed searches are kept as unreachable. A way the pool couldn't hold
+  // is searched again by the next request, the entry goes away once the
+  // requesters waiting on it are gone.
+  entry->dropped = count && !found;
+  // Still under the lock, once evicted the entry may be reused and its counter
+  // reset by another search
+  C_JobCounterSignal(game->job_sys2, &entry->done);
+  if (entry->dropped && entry->users == 0) {
+    G_PathCache_Remove(cache, idx);
+  }
+  G_PathCache_Evict(cache, false);
+  zpl_mutex_unlock(&cache->mutex);
+
+  return found != 0;
+}
+
+// Walk the way an agent heads to a tile: diagonally until a coordinate lines
+// up, then straight along the other, or the other way around. Diagonal steps
+// don't cut the corner of a wall, as in the searches. `elbow` is where the
+// legs meet.
+static bool G_Map_WalkClear(struct jps_grid *grid, int from[2], int to[2],
+                            bool straight_first, int elbow[2]) {
+  int dx = to[0] - from[0];
+  int dy = to[1] - from[1];
+  int sx = (dx > 0) - (dx < 0);
+  int sy = (dy > 0) - (dy < 0);
+  int diagonal = zpl_min(abs(dx), abs(dy));
+  int straight = zpl_max(abs(dx), abs(dy)) - diagonal;
+
+  int x = from[0];
+  int y = from[1];
+  for (int leg = 0; leg < 2; leg++) {
+    bool diagonal_leg = (leg == 0) != straight_first;
+    int steps = diagonal_leg ? diagonal : straight;
+    int mx = diagonal_leg || abs(dx) > abs(dy) ? sx : 0;
+    int my = diagonal_leg || abs(dy) > abs(dx) ? sy : 0;
+
+    for (int step = 0; step < steps; step++) {
+      if (jps_is_obstacle(grid, x + mx, y + my) ||
+          (diagonal_leg && (jps_is_obstacle(grid, x + mx, y) ||
+                            jps_is_obstacle(grid, x, y + my)))) {
+        return false;
+      }
+      x += mx;
+      y += my;
+    }
+
+    if (leg == 0) {
+      elbow[0] = x;
+      elbow[1] = y;
+    }
+  }
+
+  return true;
+}
+
+// Point `path` to the end when nothing stands in the way, without searching.
+// Going there directly takes a single waypoint, starting with the straight leg
+// takes two.
+static bool G_Map_StraightPath(map_t *map, vec2 start, vec2 end,
+                               cpu_path_t *path) {
+  int from[2] = {start[0], start[1]};
+  int to[2] = {end[0], end[1]};
+  if (from[0] < 0 || from[1] < 0 || from[0] >= (int)map->w || from[1] >= (int)map->h ||
+      to[0] < 0 || to[1] < 0 || to[0] >= (int)map->w || to[1] >= (int)map->h ||
+      (from[0] == to[0] && from[1] == to[1])) {
+    return false;
+  }
+
+  int elbow[2];
+  unsigned count;
+  if (G_Map_WalkClear(map->jps_grid, from, to, false, elbow)) {
+    count = 1;
+  } else if (from[0] != to[0] && from[1] != to[1] &&
+             abs(to[0] - from[0]) != abs(to[1] - from[1]) &&
+             G_Map_WalkClear(map->jps_grid, from, to, true, elbow)) {
+    count = 2;
+  } else {
+    return false;
+  }
+
+  unsigned found = G_PathPool_Alloc(map->path_pool, count);
+  if (!found) {
+    return false;
+  }
+
+  path_block_t *block = G_PathPool_Block(map->path_pool, found - 1);
+  if (count == 2) {
+    block->points[0][0] = elbow[0];
+    block->points[0][1] = elbow[1];
+  }
+  block->points[count - 1][0] = to[0];
+  block->points[count - 1][1] = to[1];
+
+  G_Path_Release(path);
+  G_Path_Set(path, map->path_pool, found, count);
+  C_PROFILER_COUNT("Paths Straight", 1);
+
+  return true;
+}
+
+path_index_t *G_PathIndex_Create(unsigned w, unsigned h) {
+  path_index_t *index = calloc(1, sizeof(path_index_t));
+
+  index->columns = (w + PATH_INDEX_CELL - 1) / PATH_INDEX_CELL;
+  index->rows = (h + PATH_INDEX_CELL - 1) / PATH_INDEX_CELL;
+  index->cells = calloc(index->columns * index->rows, sizeof(path_index_cell_t));
+
+  return index;
+}
+
+void G_PathIndex_Destroy(path_index_t *index) {
+  for (unsigned c = 0; c < index->columns * index->rows; c++) {
+    free(index->cells[c].paths);
+  }
+  free(index->cells);
+  free(index->changed);
+  free(index);
+}
+
+void G_Map_InvalidatePaths(map_t *map, int x, int y) {
+  path_index_t *index = map->path_index;
+
+  if (index->changed_count == index->changed_capacity) {
+    index->changed_capacity = index->changed_capacity ? index->changed_capacity * 2 : 64;
+    index->changed = realloc(index->changed, index->changed_capacity * sizeof(int));
+  }
+  index->changed[index->changed_count++] = y * (int)map->w + x;
+}
+
+static bool G_PathIndex_Follows(game_t *game, path_request_t entry) {
+  cpu_agent_t *agent = &game->cpu_agents[entry.agent];
+  return agent->state == AGENT_MOVING && !agent->flow_field &&
+         agent->path_request == entry.stamp;
+}
+
+static void G_PathIndex_Push(path_index_t *index, game_t *game, unsigned cell,
+                             path_request_t entry) {
+  path_index_cell_t *the_cell = &index->cells[cell];
+
+  if (the_cell->count == the_cell->capacity) {
+    // Make room among the stale entries first, only grow when they're few
+    unsigned kept = 0;
+    for (unsigned e = 0; e < the_cell->count; e++) {
+      if (G_PathIndex_Follows(game, the_cell->paths[e])) {
+        the_cell->paths[kept++] = the_cell->paths[e];
+      }
+    }
+    the_cell->count = kept;
+
+    if (kept >= the_cell->capacity / 2) {
+      the_cell->capacity = the_cell->capacity ? the_cell->capacity * 2 : 16;
+      the_cell->paths = realloc(the_cell->paths, the_cell->capacity * sizeof(path_request_t));
+    }
+  }
+
+  the_cell->paths[the_cell->count++] = entry;
+}
+
+// Walk the path the way the agent will, from where it stands, and file it in
+// every cell it goes through. The corners diagonal steps pass by are in the
+// cells next to them, see G_Map_RepathBlocked.
+static void G_PathIndex_Add(path_index_t *index, game_t *game, unsigned entity) {
+  cpu_agent_t *agent = &game->cpu_agents[entity];
+  path_request_t entry = {.agent = entity, .stamp = agent->path_request};
+
+  int x = game->transforms[entity].position[0];
+  int y = game->transforms[entity].position[1];
+  unsigned last = (y / PATH_INDEX_CELL) * index->columns + x / PATH_INDEX_CELL;
+  G_PathIndex_Push(index, game, last, entry);
+
+  // Only a cursor, the reference stays with the agent
+  cpu_path_t path = agent->computed_path;
+  for (; path.current < path.count; G_Path_Advance(&path)) {
+    vec2 next;
+    G_Path_Point(&path, next);
+
+    while (x != (int)next[0] || y != (int)next[1]) {
+      x += (next[0] > x) - (next[0] < x);
+      y += (next[1] > y) - (next[1] < y);
+
+      unsigned cell = (y / PATH_INDEX_CELL) * index->columns + x / PATH_INDEX_CELL;
+      if (cell != last) {
+        G_PathIndex_Push(index, game, cell, entry);
+        last = cell;
+      }
+    }
+  }
+}
+
+// Send back searching the agents a changed tile now stands in the way of, from
+// where they are. Only the cells around the changes are looked at, and the
+// rest of the way of every agent there checked again.
+static void G_Map_RepathBlocked(game_t *game, map_t *map, unsigned thread_idx) {
+  path_index_t *index = map->path_index;
+  if (index->changed_count == 0) {
+    return;
+  }
+
+  // A tile blocks the steps into it and the diagonal ones around it
+  unsigned cell_count = index->columns * index->rows;
+  bool *dirty = G_FrameAlloc(game, thread_idx, cell_count * sizeof(bool));
+  memset(dirty, 0, cell_count * sizeof(bool));
+  for (unsigned c = 0; c < index->changed_count; c++) {
+    int x = index->changed[c] % (int)map->w;
+    int y = index->changed[c] / (int)map->w;
+    for (int yy = zpl_max(y - 1, 0); yy <= zpl_min(y + 1, (int)map->h - 1); yy++) {
+      for (int xx = zpl_max(x - 1, 0); xx <= zpl_min(x + 1, (int)map->w - 1); xx++) {
+        dirty[(yy / PATH_INDEX_CELL) * index->columns + xx / PATH_INDEX_CELL] = true;
+      }
+    }
+  }
+  index->changed_count = 0;
+
+  unsigned checked = 0;
+  unsigned invalidated = 0;
+  for (unsigned c = 0; c < cell_count; c++) {
+    if (!dirty[c]) {
+      continue;
+    }
+
+    path_index_cell_t *cell = &index->cells[c];
+    unsigned kept = 0;
+    for (unsigned e = 0; e < cell->count; e++) {
+      path_request_t entry = cell->paths[e];
+      if (!G_PathIndex_Follows(game, entry)) {
+        continue;
+      }
+
+      cpu_agent_t *agent = &game->cpu_agents[entry.agent];
+      int from[2] = {game->transforms[entry.agent].position[0],
+                     game->transforms[entry.agent].position[1]};
+      bool clear = true;
+      cpu_path_t path = agent->computed_path;
+      for (; clear && path.current < path.count; G_Path_Advance(&path)) {
+        vec2 next;
+        G_Path_Point(&path, next);
+
+        int to[2] = {next[0], next[1]};
+        int elbow[2];
+        clear = G_Map_WalkClear(map->jps_grid, from, to, false, elbow);
+        from[0] = to[0];
+        from[1] = to[1];
+      }
+      checked++;
+
+      if (clear) {
+        cell->paths[kept++] = entry;
+        continue;
+      }
+
+      // Through the usual requests, the path is dropped once a new one comes
+      agent->state = AGENT_PATH_FINDING;
+      invalidated++;
+    }
+    cell->count = kept;
+  }
+
+  C_PROFILER_COUNT("Paths Checked", checked);
+  C_PROFILER_COUNT("Paths Invalidated", invalidated);
+}
+
+void G_PathRequests_Destroy(path_request_queue_t *queue) {
+  for (unsigned p = 0; p < PATH_PRIORITY_COUNT; p++) {
+    free(queue->requests[p]);
+  }
+  memset(queue, 0, sizeof(path_request_queue_t));
+}
+
+void G_PathRequests_Clear(path_request_queue_t *queue) {
+  for (unsigned p = 0; p < PATH_PRIORITY_COUNT; p++) {
+    queue->head[p] = 0;
+    queue->count[p] = 0;
+  }
+}
+
+static void G_PathRequests_Push(path_request_queue_t *queue, unsigned priority,
+                                path_request_t request) {
+  if (queue->count[priority] == queue->capacity[priority]) {
+    // Unwrap the ring while growing it
+    unsigned capacity = queue->capacity[priority] ? queue->capacity[priority] * 2 : 64;
+    path_request_t *requests = malloc(capacity * sizeof(path_request_t));
+    for (unsigned i = 0; i < queue->count[priority]; i++) {
+      requests[i] = queue->requests[priority][(queue->head[priority] + i) %
+                                              queue->capacity[priority]];
+    }
+    free(queue->requests[priority]);
+    queue->requests[priority] = requests;
+    queue->capacity[priority] = capacity;
+    queue->head[priority] = 0;
+  }
+
+  unsigned tail = (queue->head[priority] + queue->count[priority]) %
+                  queue->capacity[priority];
+  queue->requests[priority][tail] = request;
+  queue->count[priority]++;
+}
+
+// Next request still wanted, dropping the others on the way
+static bool G_PathRequests_Pop(path_request_queue_t *queue, game_t *game,
+                               unsigned *agent) {
+  for (unsigned p = 0; p < PATH_PRIORITY_COUNT; p++) {
+    while (queue->count[p]) {
+      path_request_t request = queue->requests[p][queue->head[p]];
+      queue->head[p] = (queue->head[p] + 1) % queue->capacity[p];
+      queue->count[p]--;
+
+      cpu_agent_t *the_agent = &game->cpu_agents[request.agent];
+      if (the_agent->state == AGENT_WAITING_PATH &&
+          the_agent->path_request == request.stamp) {
+        *agent = request.agent;
+        return true;
+      }
+    }
+  }
+
+  return false;
+}
+
+path_priority_t G_PathPriority(cpu_agent_t *agent) {
+  if (agent->state == AGENT_DRAFTED || (agent->type & AGENT_PLAYER)) {
+    return PATH_PRIORITY_ORDERED;
+  }
+  if (agent->type & AGENT_ANIMAL) {
+    return PATH_PRIORITY_IDLE;
+  }
+
+  return PATH_PRIORITY_NORMAL;
+}
+
+typedef struct path_batch_job_t {
+  unsigned *agents;
+  map_t *map;
+  game_t *game;
+} path_batch_job_t;
+
+static void G_WorkerSearchPathBatch(void *data, unsigned begin, unsigned end,
+                                    unsigned thread_idx) {
+  path_batch_job_t *job = data;
+  game_t *game = job->game;
+
+  for (unsigned b = begin; b < end; b++) {
+    unsigned entity = job->agents[b];
+    cpu_agent_t *agent = &game->cpu_agents[entity];
+    if (!G_Map_FindPath(game, job->map, thread_idx,
+                        game->transforms[entity].position, agent->target,
+                        &agent->computed_path)) {
+      agent->state = AGENT_NOTHING;
+      continue;
+    }
+
+    agent->state = AGENT_MOVING;
+  }
+}
+
+void G_WorkerServePathRequests(void *data, unsigned thread_idx) {
+  path_request_job_t *job = data;
+  game_t *game = job->game;
+  path_request_queue_t *queue = &game->path_requests;
+
+  map_t *map = &game->current_scene->maps[job->map];
+
+  // Walls placed since the last tick, before the requests are taken in
+  G_Map_RepathBlocked(game, map, thread_idx);
+
+  // Requests of the tick join the ones left by the previous ticks, an agent
+  // asking again drops its previous request. Ends in sight are served right
+  // away, they don't need a search.
+  for (unsigned a = 0; a < job->agent_count; a++) {
+    unsigned entity = job->agents[a];
+    cpu_agent_t *agent = &game->cpu_agents[entity];
+    if (agent->state != AGENT_PATH_FINDING) {
+      continue;
+    }
+
+    agent->flow_field = 0;
+    if (G_Map_StraightPath(map, game->transforms[entity].position,
+                           agent->target, &agent->computed_path)) {
+      agent->state = AGENT_MOVING;
+      agent->path_request++;
+      G_PathIndex_Add(map->path_index, game, entity);
+      continue;
+    }
+
+    agent->state = AGENT_WAITING_PATH;
+    agent->path_request++;
+    G_PathRequests_Push(queue, agent->path_priority,
+                        (path_request_t){.agent = entity, .stamp = agent->path_request});
+
+    // Stand still until the path comes
+    game->gpu_agents[entity].direction[0] = 0.0f;
+    game->gpu_agents[entity].direction[1] = 0.0f;
+  }
+
+  // Batches keep every worker busy, the clock is only checked between them.
+  // The first one always runs, so a tiny budget still makes progress.
+  unsigned batch_size = game->worker_count * PATH_FINDING_JOB_GRAIN;
+  unsigned *batch = G_FrameAlloc(game, thread_idx, batch_size * sizeof(unsigned));
+  path_batch_job_t batch_job = {
+      .agents = batch,
+      .map = map,
+      .game = game,
+  };
+
+  // zpl_time_rel only counts milliseconds, as coarse as the budget itself
+  double deadline = C_ProfilerNow() + game->path_budget / 1000.0;
+  unsigned searched = 0;
+  do {
+    unsigned count = 0;
+    while (count < batch_size && G_PathRequests_Pop(queue, game, &batch[count])) {
+      count++;
+    }
+    if (count == 0) {
+      break;
+    }
+
+    C_JobSystemParallelFor(game->job_sys2, 0, count, PATH_FINDING_JOB_GRAIN,
+                           G_WorkerSearchPathBatch, &batch_job);
+    for (unsigned b = 0; b < count; b++) {
+      if (game->cpu_agents[batch[b]].state == AGENT_MOVING) {
+        G_PathIndex_Add(map->path_index, game, batch[b]);
+      }
+    }
+    searched += count;
+  } while (C_ProfilerNow() < deadline);
+
+  unsigned waiting = 0;
+  for (unsigned p = 0; p < PATH_PRIORITY_COUNT; p++) {
+    waiting += queue->count[p];
+  }
+  C_PROFILER_COUNT("Path Requests Served", searched);
+  C_PROFILER_COUNT("Path Requests Waiting", waiting);
+  C_PROFILER_COUNT("Path Pool Blocks", batch_job.map->path_pool->used);
+}
+
+// Same order as the JPS directions, clockwise from up
+static const int flow_dx[8] = {0, 1, 1, 1, 0, -1, -1, -1};
+static const int flow_dy[8] = {-1, -1, 0, 1, 1, 1, 0, -1};
+
+void G_FlowFields_Destroy(flow_field_t *fields) {
+  for (unsigned i = 0; i < FLOW_FIELD_SLOTS; i++) {
+    free(fields[i].cost);
+    free(fields[i].direction);
+    for (unsigned b = 0; b < FLOW_FIELD_BUCKETS; b++) {
+      free(fields[i].buckets[b]);
+    }
+  }
+
+  free(fields);
+}
+
+static void G_FlowField_Push(flow_field_t *field, unsigned cost, int tile) {
+  unsigned b = cost % FLOW_FIELD_BUCKETS;
+  if (field->bucket_count[b] == field->bucket_capacity[b]) {
+    field->bucket_capacity[b] = field->bucket_capacity[b] ? field->bucket_capacity[b] * 2 : 64;
+    field->buckets[b] = realloc(field->buckets[b], field->bucket_capacity[b] * sizeof(int));
+  }
+  field->buckets[b][field->bucket_count[b]++] = tile;
+}
+
+// Dijkstra from the goal with the costs and corner rule of the searches. Steps
+// cost 5 or 7, so the open tiles only span FLOW_FIELD_BUCKETS costs and a
+// bucket never grows while it's processed. The direction of a tile is set
+// along with its cost, toward the tile it was reached from.
+static void G_FlowField_Build(flow_field_t *field, struct jps_grid *grid) {
+  C_PROFILER_ZONE("Flow Field Build");
+
+  int w = grid->width;
+  int h = grid->height;
+
+  if (!field->cost) {
+    field->cost = malloc(w * h * sizeof(unsigned));
+    field->direction = malloc(w * h);
+  }
+  memset(field->cost, 0xff, w * h * sizeof(unsigned));
+  memset(field->direction, FLOW_FIELD_NO_DIRECTION, w * h);
+  for (unsigned b = 0; b < FLOW_FIELD_BUCKETS; b++) {
+    field->bucket_count[b] = 0;
+  }
+  field->built = true;
+
+  // Nothing leads into a wall
+  if (jps_is_obstacle(grid, field->goal % w, field->goal / w)) {
+    return;
+  }
+
+  field->cost[field->goal] = 0;
+  G_FlowField_Push(field, 0, field->goal);
+  unsigned pending = 1;
+  unsigned long integrated = 0;
+
+  for (unsigned cost = 0; pending; cost++) {
+    unsigned b = cost % FLOW_FIELD_BUCKETS;
+    unsigned count = field->bucket_count[b];
+    field->bucket_count[b] = 0;
+    pending -= count;
+
+    for (unsigned i = 0; i < count; i++) {
+      int tile = field->buckets[b][i];
+      // Reached again for cheaper since it was pushed
+      if (field->cost[tile] != cost) {
+        continue;
+      }
+      integrated++;
+
+      int x = tile % w;
+      int y = tile / w;
+      for (unsigned d = 0; d < 8; d++) {
+        int nx = x + flow_dx[d];
+        int ny = y + flow_dy[d];
+        if (nx < 0 || ny < 0 || nx >= w || ny >= h || jps_is_obstacle(grid, nx, ny)) {
+          continue;
+        }
+        // Diagonals don't cut corners, both sides have to be free
+        if ((d & 1) &&
+            (jps_is_obstacle(grid, nx, y) || jps_is_obstacle(grid, x, ny))) {
+          continue;
+        }
+
+        int next = ny * w + nx;
+        unsigned next_cost = cost + ((d & 1) ? 7 : 5);
+        if (next_cost < field->cost[next]) {
+          field->cost[next] = next_cost;
+          field->direction[next] = (d + 4) % 8;
+          G_FlowField_Push(field, next_cost, next);
+          pending++;
+        }
+      }
+    }
+  }
+
+  C_PROFILER_COUNT("Flow Field Tiles", integrated);
+}
+
+typedef struct flow_field_build_job_t {
+  flow_field_t **fields;
+  struct jps_grid *grid;
+} flow_field_build_job_t;
+
+static void G_WorkerBuildFlowFields(void *data, unsigned begin, unsigned end,
+                                    unsigned thread_idx) {
+  flow_field_build_job_t *job = data;
+
+  for (unsigned i = begin; i < end; i++) {
+    G_FlowField_Build(job->fields[i], job->grid);
+  }
+}
+
+typedef struct flow_goal_t {
+  bool used;
+  int tile;
+  unsigned requesters;
+  unsigned slot; // slot + 1 of the field, 0 when the requesters search paths
+} flow_goal_t;
+
+static int G_TargetTile(map_t *map, vec2 target) {
+  int x = target[0];
+  int y = target[1];
+  if (x < 0 || y < 0 || x >= (int)map->w || y >= (int)map->h) {
+    return -1;
+  }
+
+  return y * (int)map->w + x;
+}
+
+static flow_goal_t *G_FlowGoal(flow_goal_t *goals, unsigned mask, int tile) {
+  unsigned i = ((uint32_t)tile * 0x9e3779b1u) & mask;
+  while (goals[i].used && goals[i].tile != tile) {
+    i = (i + 1) & mask;
+  }
+
+  return &goals[i];
+}
+
+static int G_FlowField_Holding(map_t *map, int tile) {
+  for (int s = 0; s < FLOW_FIELD_SLOTS; s++) {
+    if (map->flow_fields[s].built && map->flow_fields[s].goal == tile) {
+      return s;
+    }
+  }
+
+  return -1;
+}
+
+// Slots nobody follows anymore, never built ones first
+static int G_FlowField_Free(map_t *map, unsigned *followers, bool *claimed) {
+  int free_slot = -1;
+  for (int s = 0; s < FLOW_FIELD_SLOTS; s++) {
+    if (claimed[s] || followers[s] != 0) {
+      continue;
+    }
+    if (!map->flow_fields[s].built) {
+      return s;
+    }
+    if (free_slot == -1) {
+      free_slot = s;
+    }
+  }
+
+  return free_slot;
+}
+
+void G_WorkerAssignFlowFields(void *data, unsigned thread_idx) {
+  flow_field_job_t *job = data;
+  game_t *game = job->game;
+  map_t *map = &game->current_scene->maps[job->map];
+  unsigned revision = map->jps_grid->revision;
+
+  unsigned size = 16;
+  while (size < job->agent_count * 2) {
+    size *= 2;
+  }
+  flow_goal_t *goals = G_FrameAlloc(game, thread_idx, size * sizeof(flow_goal_t));
+
+  // Count who asks for each goal, and who still follows each field
+  unsigned followers[FLOW_FIELD_SLOTS] = {0};
+  unsigned crowded = 0;
+  for (unsigned a = 0; a < job->agent_count; a++) {
+    cpu_agent_t *agent = &game->cpu_agents[job->agents[a]];
+
+    if (agent->state == AGENT_MOVING && agent->flow_field) {
+      followers[agent->flow_field - 1]++;
+    } else if (agent->state == AGENT_PATH_FINDING ||
+               agent->state == AGENT_WAITING_PATH) {
+      int tile = G_TargetTile(map, agent->target);
+      if (tile == -1) {
+        continue;
+      }
+      flow_goal_t *goal = G_FlowGoal(goals, size - 1, tile);
+      goal->used = true;
+      goal->tile = tile;
+      goal->requesters++;
+      if (goal->requesters == FLOW_FIELD_MIN_REQUESTERS + 1) {
+        crowded++;
+      }
+    }
+  }
+
+  if (crowded == 0) {
+    return;
+  }
+
+  // Crowded goals keep the slot they had in the previous ticks first, and only
+  // then take the slots left. Fields are kept while the walls stay the same,
+  // and built again otherwise.
+  bool claimed[FLOW_FIELD_SLOTS] = {0};
+  flow_field_t *to_build[FLOW_FIELD_SLOTS];
+  unsigned build_count = 0;
+  for (unsigned pass = 0; pass < 2; pass++) {
+    for (unsigned i = 0; i < size; i++) {
+      flow_goal_t *goal = &goals[i];
+      if (!goal->used || goal->requesters <= FLOW_FIELD_MIN_REQUESTERS || goal->slot) {
+        continue;
+      }
+
+      // Out of slots, the goal falls back to the path cache
+      int s = pass == 0 ? G_FlowField_Holding(map, goal->tile)
+                        : G_FlowField_Free(map, followers, claimed);
+      if (s == -1) {
+        continue;
+      }
+      claimed[s] = true;
+      goal->slot = s + 1;
+
+      flow_field_t *field = &map->flow_fields[s];
+      if (!field->built || field->goal != goal->tile || field->revision != revision) {
+        field->goal = goal->tile;
+        field->revision = revision;
+        to_build[build_count++] = field;
+      }
+    }
+  }
+
+  flow_field_build_job_t build_job = {
+      .fields = to_build,
+      .grid = map->jps_grid,
+  };
+  C_JobSystemParallelFor(game->job_sys2, 0, build_count, 1,
+                         G_WorkerBuildFlowFields, &build_job);
+
+  for (unsigned a = 0; a < job->agent_count; a++) {
+    unsigned entity = job->agents[a];
+    cpu_agent_t *agent = &game->cpu_agents[entity];
+    // Queued requests are dropped by leaving AGENT_WAITING_PATH
+    if (agent->state != AGENT_PATH_FINDING && agent->state != AGENT_WAITING_PATH) {
+      continue;
+    }
+    int tile = G_TargetTile(map, agent->target);
+    if (tile == -1) {
+      continue;
+    }
+    flow_goal_t *goal = G_FlowGoal(goals, size - 1, tile);
+    if (!goal->slot) {
+      continue;
+    }
+
+    // Walk to the tile the agent stands on first, like a searched path starts
+    C_PROFILER_COUNT("Flow Field Agents", 1);
+    agent->flow_field = goal->slot;
+    agent->flow_next[0] = (int)game->transforms[entity].position[0];
+    agent->flow_next[1] = (int)game->transforms[entity].position[1];
+    G_Path_Release(&agent->computed_path);
+    agent->state = AGENT_MOVING;
+  }
+}
+
+bool G_Map_FollowFlowField(map_t *map, cpu_agent_t *agent, vec2 position) {
+  flow_field_t *field = &map->flow_fields[agent->flow_field - 1];
+
+  // The slot went to another goal, or walls changed since it was built
+  if (!field->built || field->goal != G_TargetTile(map, agent->target) ||
+      field->revision != map->jps_grid->revision) {
+    agent->flow_field = 0;
+    agent->state = AGENT_PATH_FINDING;
+    return false;
+  }
+
+  int x = position[0];
+  int y = position[1];
+  bool inside = x >= 0 && y >= 0 && x < (int)map->w && y < (int)map->h;
+  unsigned char d = inside ? field->direction[y * (int)map->w + x] : FLOW_FIELD_NO_DIRECTION;
+  if (d == FLOW_FIELD_NO_DIRECTION) {
+    agent->flow_field = 0;
+    agent->state = AGENT_NOTHING;
+    return false;
+  }
+
+  agent->flow_next[0] = x + flow_dx[d];
+  agent->flow_next[1] = y + flow_dy[d];
+
+  return true;
+}
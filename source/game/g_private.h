@@ -18,6 +18,10 @@
 #include FT_FREETYPE_H
 
 struct map;
+struct jps_grid;
+struct hpa;
+struct hpa_search;
+typedef struct int_list IntList;
 
 ZPL_TABLE_DECLARE(extern, material_bank_t, G_Materials_, material_t)
 ZPL_TABLE_DECLARE(extern, texture_bank_t, G_ImmediateTextures_, texture_t)
@@ -29,28 +33,68 @@ ZPL_TABLE_DECLARE(extern, pawn_bank_t, G_Pawns_, pawn_t)
 ZPL_TABLE_DECLARE(extern, facility_bank_t, G_Facilities_, facility_t)
 ZPL_TABLE_DECLARE(extern, inventory_t, G_Inventory_, float)
 
+#define PATH_BLOCK_POINTS 15 // blocks of 128 bytes
+#define PATH_POOL_CHUNK_BLOCKS 1024
+#define PATH_POOL_CHUNKS 256
+#define PATH_POOL_NONE -1
+
+// Waypoints of a path are spread over a chain of blocks
+typedef struct path_block_t {
+  atomic_uint refs; // only counted on the first block of a path
+  int next;         // next block of the path, or of the free list
+  vec2 points[PATH_BLOCK_POINTS];
+} path_block_t;
+
+// Every path of a map lives here, shared by the agents following it and the
+// path cache. Chunks never move once allocated, so blocks are read without the
+// lock while other threads allocate.
+typedef struct path_pool_t {
+  zpl_mutex mutex;
+
+  path_block_t *chunks[PATH_POOL_CHUNKS]; // PATH_POOL_CHUNK_BLOCKS each
+  unsigned chunk_count;
+  int free_list;
+  unsigned used; // blocks held by paths
+} path_pool_t;
+
+// A reference to a path of the pool, see G_Map_FindPath
 typedef struct cpu_path_t {
-  vec2 *points;
+  path_pool_t *pool;
+  unsigned head; // first block + 1, 0 without a path
+  int block;     // block of the current waypoint
   unsigned count;
   unsigned current;
 } cpu_path_t;
 
+// What the tick reads and writes of every agent, a cache line each. Fields
+// moving agents touch come first, the rest waits in side tables such as
+// agent_inventory_t.
 typedef struct cpu_agent_t {
-  vec2 target;
-  float speed;
   enum agent_state_e {
     AGENT_NOTHING,
     AGENT_PATH_FINDING,
     AGENT_MOVING,
     AGENT_DRAFTED,
+    AGENT_WAITING_PATH, // queued, see G_WorkerServePathRequests
   } state;
-  agent_type_t type;
+  float speed;
+  vec2 flow_next; // tile walked to before asking the field again
+  // Slot + 1 of the flow field followed instead of computed_path, 0 for none
+  unsigned flow_field;
+  unsigned path_request; // bumped by every request, see path_request_t
   cpu_path_t computed_path;
 
-  inventory_t inventory;
-  bool inventory_initialized;
+  vec2 target;
+  agent_type_t type;
+  unsigned char path_priority; // path_priority_t of its requests
 } __attribute__((aligned(16))) cpu_agent_t;
 
+// Only QC calls look at it, out of the way of the tick
+typedef struct agent_inventory_t {
+  inventory_t items;
+  bool initialized;
+} agent_inventory_t;
+
 typedef struct cpu_tile_t {
   float health;
 
@@ -63,24 +107,66 @@ typedef struct cpu_tile_t {
 
 typedef struct node_t node_t;
 
-#define THINK_JOB_BATCH_AGENT_SIZE 64
+// Initial size of each thread frame arena, it grows when a tick needed more
+#define FRAME_ARENA_SIZE (512 * 1024)
+
+// Scratch memory of one thread, only valid until the end of the tick. Job
+// procs get to theirs through their `thread_idx`.
+typedef struct frame_memory_t {
+  zpl_arena arena;
+
+  // Allocations that didn't fit in the arena, freed on the next reset
+  void **overflows;
+  unsigned overflow_count;
+  unsigned overflow_capacity;
+  zpl_isize overflow_size;
+
+  // Every path search of the thread writes into this one
+  IntList *path_list;
+} __attribute__((aligned(64))) frame_memory_t;
+
+// What the phases of a tick read and write, so the frame graph knows which ones
+// may run at the same time
+typedef enum frame_resource_t {
+  FRAME_RESOURCE_AGENTS = 1 << 0,
+  FRAME_RESOURCE_TILES = 1 << 1,
+  FRAME_RESOURCE_TEXTS = 1 << 2,
+} frame_resource_t;
+
+// Agents/rows a worker processes in one go. Larger ranges are split down to it
+// only while other workers are idle and take the halves left for them.
+#define THINK_JOB_GRAIN 16
+#define PATH_FINDING_JOB_GRAIN 4
+#define ITEM_TEXT_JOB_GRAIN 4
+
 typedef struct think_job_t {
-  unsigned agents[THINK_JOB_BATCH_AGENT_SIZE]; // a think job handles more than 1 agent to reduce contention in the job system
-  unsigned agent_count;
+  unsigned *agents;
 
   game_t *game;
 } think_job_t;
 
 typedef struct path_finding_job_t {
-  unsigned agent;
+  unsigned *agents;
   unsigned map;
   float delta;
   game_t *game;
 } path_finding_job_t;
 
-typedef struct item_text_job_t {
-  unsigned row;
+typedef struct path_request_job_t {
+  unsigned *agents;
+  unsigned agent_count;
+  unsigned map;
+  game_t *game;
+} path_request_job_t;
 
+typedef struct flow_field_job_t {
+  unsigned *agents;
+  unsigned agent_count;
+  unsigned map;
+  game_t *game;
+} flow_field_job_t;
+
+typedef struct item_text_job_t {
   game_t *game;
 } item_text_job_t;
 
@@ -111,8 +197,133 @@ typedef struct texture_job_t {
   const char *path;
 } texture_job_t;
 
+#define PATH_CACHE_ENTRIES 1024
+#define PATH_CACHE_BUCKETS 2048 // power of two
+#define PATH_CACHE_MAX_BYTES (2 * 1024 * 1024)
+#define PATH_CACHE_NONE -1
+
+typedef struct path_cache_entry_t {
+  // A path is only valid for the obstacles it was computed on
+  int start;
+  int end;
+  unsigned revision;
+
+  unsigned path; // first block + 1 in the pool, 0 when unreachable
+  unsigned count;
+
+  bool pending;   // the first requester is still searching
+  bool dropped;   // found but the pool was full, left to the next request
+  unsigned users; // requesters waiting on `done`, the entry can't be evicted
+  job_counter_t done;
+
+  int prev; // LRU order, most recent first
+  int next;
+  int chain; // next entry of the same bucket, or of the free list
+} path_cache_entry_t;
+
+typedef struct path_cache_t {
+  zpl_mutex mutex;
+  path_pool_t *pool; // of the same map
+
+  path_cache_entry_t entries[PATH_CACHE_ENTRIES];
+  int buckets[PATH_CACHE_BUCKETS];
+  int lru_head;
+  int lru_tail;
+  int free_list;
+
+  zpl_isize bytes; // blocks held by the entries
+} path_cache_t;
+
+#define FLOW_FIELD_SLOTS 8
+// Goals requested by more agents than that in a single tick get a flow field
+// instead of one search per agent
+#define FLOW_FIELD_MIN_REQUESTERS 8
+#define FLOW_FIELD_UNREACHABLE UINT_MAX
+#define FLOW_FIELD_NO_DIRECTION 0xff
+#define FLOW_FIELD_BUCKETS 8 // more than the cost of a diagonal step
+
+typedef struct flow_field_t {
+  // Every tile leads to `goal`, as long as the walls are at `revision`
+  int goal;
+  unsigned revision;
+  bool built;
+
+  unsigned *cost;           // integration field, distance to the goal
+  unsigned char *direction; // direction field, next step toward the goal
+
+  // Tiles left to integrate, by cost modulo FLOW_FIELD_BUCKETS
+  int *buckets[FLOW_FIELD_BUCKETS];
+  unsigned bucket_count[FLOW_FIELD_BUCKETS];
+  unsigned bucket_capacity[FLOW_FIELD_BUCKETS];
+} flow_field_t;
+
+// Requests are served in that order, first come first served within each
+typedef enum path_priority_t {
+  PATH_PRIORITY_ORDERED, // drafted and player agents, somebody waits on them
+  PATH_PRIORITY_NORMAL,
+  PATH_PRIORITY_IDLE, // animals wandering around
+  PATH_PRIORITY_COUNT,
+} path_priority_t;
+
+// Milliseconds of path searches per tick unless QC says otherwise, requests
+// left wait for the next tick
+#define PATH_REQUEST_BUDGET_MS 2.0f
+
+// Still wanted as long as `stamp` matches the path_request of the agent, an
+// agent asking again or leaving AGENT_WAITING_PATH drops it
+typedef struct path_request_t {
+  unsigned agent;
+  unsigned stamp;
+} path_request_t;
+
+// One ring buffer per priority
+typedef struct path_request_queue_t {
+  path_request_t *requests[PATH_PRIORITY_COUNT];
+  unsigned head[PATH_PRIORITY_COUNT];
+  unsigned count[PATH_PRIORITY_COUNT];
+  unsigned capacity[PATH_PRIORITY_COUNT];
+} path_request_queue_t;
+
+// Side of the clusters searches far away go through
+#define HPA_CLUSTER_SIZE 32
+
+// Side of the squares of tiles the path index sorts paths by
+#define PATH_INDEX_CELL 16
+
+typedef struct path_index_cell_t {
+  // Agents whose path went through, still following it while the stamp matches
+  path_request_t *paths;
+  unsigned count;
+  unsigned capacity;
+} path_index_cell_t;
+
+// Tiles to the paths crossing them, so a new wall only sends the agents it
+// stands in the way of searching again. Entries are dropped lazily, once the
+// agent follows another path.
+typedef struct path_index_t {
+  unsigned columns;
+  unsigned rows;
+  path_index_cell_t *cells;
+
+  // Tiles whose obstacle changed since the requests were last served
+  int *changed;
+  unsigned changed_count;
+  unsigned changed_capacity;
+} path_index_t;
+
 typedef struct map_t {
-  struct map *jps_maps[16];
+  struct jps_grid *jps_grid;
+  struct hpa *hpa;
+  path_pool_t *path_pool;
+  path_cache_t *path_cache;
+  path_index_t *path_index;
+  // Only written by the flow field phase of the tick, and read by the agents
+  // moving after it
+  flow_field_t *flow_fields; // FLOW_FIELD_SLOTS
+  // Search scratch, one per job system thread, made the first time the thread
+  // path-finds on this map
+  struct map **jps_maps;
+  struct hpa_search **hpa_searches;
   zpl_mutex mutex;
 
   unsigned w;
@@ -171,21 +382,44 @@ typedef struct localization_t {
   zpl_arena memory;
 } localization_t;
 
+// Entities with every component of `signature`, added as they're created so
+// systems walk exactly the ones they need. Entities are never destroyed, and
+// the list never moves: jobs keep reading it while QC adds entities.
+typedef struct entity_query_t {
+  unsigned signature;
+  unsigned *entities; // as many as the ECS holds
+  unsigned count;
+} entity_query_t;
+
+typedef enum entity_query_id_t {
+  ENTITY_QUERY_AGENTS,
+  ENTITY_QUERY_COUNT,
+} entity_query_id_t;
+
 struct game_t {
   vk_system_t *model_matrix_sys;
   vk_system_t *path_finding_sys;
 
   cpu_agent_t *cpu_agents;
+  agent_inventory_t *agent_inventories; // same entities as cpu_agents
   struct Agent *gpu_agents;
   struct Transform *transforms;
 
   unsigned entity_count;
   unsigned *entities;
+  entity_query_t queries[ENTITY_QUERY_COUNT];
 
   unsigned worker_count;
   job_system_t *job_sys2;
+  job_graph_t *frame_graph;
+  frame_memory_t *frame_memory; // one per job system thread
 
-  qcvm_t *qcvms[16];
+  // Carried from tick to tick, only touched by the path request phase
+  path_request_queue_t path_requests;
+  float path_budget; // milliseconds per tick, see G_Path_SetBudget
+
+  qcvm_t **qcvms; // one per worker
+  unsigned long qc_executed; // instructions run by all of them so far
 
   char *base;
 
@@ -251,3 +485,56 @@ void G_TerrainInstall(qcvm_t *qcvm);
 void G_Add_Wall(game_t *game, int map, int x, int y, float health,
                 wall_t *wall_recipe);
 void G_UIInstall(qcvm_t *qcvm);
+
+path_pool_t *G_PathPool_Create(void);
+void G_PathPool_Destroy(path_pool_t *pool);
+path_cache_t *G_PathCache_Create(path_pool_t *pool);
+void G_PathCache_Destroy(path_cache_t *cache);
+path_index_t *G_PathIndex_Create(unsigned w, unsigned h);
+void G_PathIndex_Destroy(path_index_t *index);
+/// @brief The obstacle of the tile changed, agents whose path goes through
+/// search again the next time requests are served.
+void G_Map_InvalidatePaths(map_t *map, int x, int y);
+/// @brief Let go of the path, its blocks go back to the pool once nobody else
+/// shares it.
+void G_Path_Release(cpu_path_t *path);
+/// @brief Current waypoint of the path, while `current < count`.
+void G_Path_Point(cpu_path_t *path, vec2 point);
+/// @brief Move on to the next waypoint.
+void G_Path_Advance(cpu_path_t *path);
+/// @brief Point `path` to the way from `start` to `end`, return false when
+/// there's none. Paths are cached per map until walls change and shared with
+/// the cache, concurrent requests for the same path wait for the first one
+/// instead of searching again. Only call it from the jobs of the tick, with
+/// their `thread_idx`.
+bool G_Map_FindPath(game_t *game, map_t *map, unsigned thread_idx, vec2 start,
+                    vec2 end, cpu_path_t *path);
+
+void G_PathRequests_Destroy(path_request_queue_t *queue);
+void G_PathRequests_Clear(path_request_queue_t *queue);
+/// @brief Drafted and player agents first, animals last.
+path_priority_t G_PathPriority(cpu_agent_t *agent);
+/// @brief Job of the tick queuing the agents in AGENT_PATH_FINDING, then
+/// searching the queue by priority on the job system until the tick spent
+/// `path_budget`. Agents wait in AGENT_WAITING_PATH until their turn comes,
+/// over several ticks if needed.
+void G_WorkerServePathRequests(void *data, unsigned thread_idx);
+
+void G_FlowFields_Destroy(flow_field_t *fields);
+/// @brief Job of the tick giving a shared flow field to the goals requested by
+/// more than FLOW_FIELD_MIN_REQUESTERS agents. Fields are built on the job
+/// system, and their requesters move right away instead of searching a path.
+void G_WorkerAssignFlowFields(void *data, unsigned thread_idx);
+/// @brief Point `agent` to the next tile of its flow field, once it stands on
+/// the previous one. Return false when the agent stops following it: it
+/// arrived, can't reach its target, or the field is stale and the agent goes
+/// back to path finding.
+bool G_Map_FollowFlowField(map_t *map, cpu_agent_t *agent, vec2 position);
+
+/// @brief Zeroed memory living until the next G_TickGame. Only call it with
+/// the `thread_idx` given to the current job, or from the main thread with its
+/// own index.
+void *G_FrameAlloc(game_t *game, unsigned thread_idx, zpl_isize size);
+/// @brief Release every frame allocation, must not run while jobs of the tick
+/// are in flight.
+void G_ResetFrameMemory(game_t *game);
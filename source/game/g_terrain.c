@@ -1,11 +1,12 @@
 #include <common/c_terminal.h>
 #include <game/g_private.h>
+#include <hpa.h>
 #include <jps.h>
 #include <string.h>
 
 // TODO: should do the same function for a circle, line, polygon, etc
 
-void G_Rectangle(ivec2 start, ivec2 end, int *indices, int *count) {
+void G_Rectangle(ivec2 start, ivec2 end, int width, int *indices, int *count) {
   // start
   //  ----------------
   // |               |
@@ -21,7 +22,7 @@ void G_Rectangle(ivec2 start, ivec2 end, int *indices, int *count) {
         [0] = i,
         [1] = start[1],
     };
-    indices[*count] = coord[1] * 256 + coord[0];
+    indices[*count] = coord[1] * width + coord[0];
     (*count)++;
   }
 
@@ -30,7 +31,7 @@ void G_Rectangle(ivec2 start, ivec2 end, int *indices, int *count) {
         [0] = i,
         [1] = end[1],
     };
-    indices[*count] = coord[1] * 256 + coord[0];
+    indices[*count] = coord[1] * width + coord[0];
     (*count)++;
   }
 
@@ -39,7 +40,7 @@ void G_Rectangle(ivec2 start, ivec2 end, int *indices, int *count) {
         [0] = start[0],
         [1] = i,
     };
-    indices[*count] = coord[1] * 256 + coord[0];
+    indices[*count] = coord[1] * width + coord[0];
     (*count)++;
   }
 
@@ -48,7 +49,7 @@ void G_Rectangle(ivec2 start, ivec2 end, int *indices, int *count) {
         [0] = end[0],
         [1] = i,
     };
-    indices[*count] = coord[1] * 256 + coord[0];
+    indices[*count] = coord[1] * width + coord[0];
     (*count)++;
   }
 }
@@ -249,15 +250,14 @@ unsigned G_ComputeWallOrientation(map_t *map, wall_t *wall, int instance_x,
 
 void G_Map_AddWall(game_t *game, int map, int x, int y, float health,
                    wall_t *wall_recipe) {
-  // Since JPS isn't multithread friendly, we maintain a copy in each worker. It
-  // forces us to lock and make the modification multiple times. We lock them
-  // all to be sure there is not bad surprise.
+  // The obstacle grid is shared by the searches of every worker, they never
+  // run while walls are placed
   zpl_mutex_lock(&game->current_scene->maps[map].mutex);
 
   map_t *the_map = &game->current_scene->maps[map];
-  for (unsigned i = 0; i < 16; i++) {
-    jps_set_obstacle(the_map->jps_maps[i], x, y, 1);
-  }
+  jps_set_obstacle(the_map->jps_grid, x, y, 1);
+  hpa_update(the_map->hpa, x, y);
+  G_Map_InvalidatePaths(the_map, x, y);
 
   unsigned idx = y * the_map->w + x;
   // Place the wall with its correct orientation
@@ -268,7 +268,7 @@ void G_Map_AddWall(game_t *game, int map, int x, int y, float health,
   // And then, maybe update its neighbors
   for (int xx = x - 1; xx < x + 2; xx++) {
     for (int yy = y - 1; yy < y + 2; yy++) {
-      if (xx < 0 || yy < 0 || xx > (int)the_map->w || yy > (int)the_map->h) {
+      if (xx < 0 || yy < 0 || xx >= (int)the_map->w || yy >= (int)the_map->h) {
         continue;
       }
 
@@ -345,6 +345,57 @@ void G_Map_AddWall_QC(qcvm_t *qcvm) {
   G_Map_AddWall(game, map, x, y, health, the_wall);
 }
 
+void G_Map_IsReachable_QC(qcvm_t *qcvm) {
+  game_t *game = qcvm_get_user_data(qcvm);
+
+  int map = qcvm_get_parm_int(qcvm, 0);
+  qcvm_vec3_t from = qcvm_get_parm_vector(qcvm, 1);
+  qcvm_vec3_t to = qcvm_get_parm_vector(qcvm, 2);
+
+  if (map < 0 || map >= (int)game->current_scene->map_count) {
+    printf(LOG_ERROR "Assertion G_Map_IsReachable_QC(map >= 0 || map < "
+                     "game->map_count) "
+                     "[map = %d, map_count = %d] should be "
+                     "verified.\n",
+           map, game->current_scene->map_count);
+    qcvm_return_int(qcvm, false);
+    return;
+  }
+
+  // Walls may be placed by another worker meanwhile
+  map_t *the_map = &game->current_scene->maps[map];
+  zpl_mutex_lock(&the_map->mutex);
+  bool reachable = jps_is_reachable(the_map->jps_grid, from.x, from.y, to.x, to.y);
+  zpl_mutex_unlock(&the_map->mutex);
+
+  qcvm_return_int(qcvm, reachable);
+}
+
+void G_Map_GetArea_QC(qcvm_t *qcvm) {
+  game_t *game = qcvm_get_user_data(qcvm);
+
+  int map = qcvm_get_parm_int(qcvm, 0);
+  float x = qcvm_get_parm_float(qcvm, 1);
+  float y = qcvm_get_parm_float(qcvm, 2);
+
+  if (map < 0 || map >= (int)game->current_scene->map_count) {
+    printf(LOG_ERROR "Assertion G_Map_GetArea_QC(map >= 0 || map < "
+                     "game->map_count) "
+                     "[map = %d, map_count = %d] should be "
+                     "verified.\n",
+           map, game->current_scene->map_count);
+    qcvm_return_int(qcvm, 0);
+    return;
+  }
+
+  map_t *the_map = &game->current_scene->maps[map];
+  zpl_mutex_lock(&the_map->mutex);
+  int area = jps_component(the_map->jps_grid, x, y);
+  zpl_mutex_unlock(&the_map->mutex);
+
+  qcvm_return_int(qcvm, area);
+}
+
 void G_TerrainInstall(qcvm_t *qcvm) {
   qcvm_export_t export_G_Map_SetTerrainType = {
       .func = G_Map_SetTerrainType_QC,
@@ -377,7 +428,27 @@ void G_TerrainInstall(qcvm_t *qcvm) {
       .args[5] = {.name = "map", .type = QCVM_INT},
   };
 
+  qcvm_export_t export_G_Map_IsReachable = {
+      .func = G_Map_IsReachable_QC,
+      .name = "G_Map_IsReachable",
+      .argc = 3,
+      .args[0] = {.name = "map", .type = QCVM_INT},
+      .args[1] = {.name = "from", .type = QCVM_VECTOR},
+      .args[2] = {.name = "to", .type = QCVM_VECTOR},
+  };
+
+  qcvm_export_t export_G_Map_GetArea = {
+      .func = G_Map_GetArea_QC,
+      .name = "G_Map_GetArea",
+      .argc = 3,
+      .args[0] = {.name = "map", .type = QCVM_INT},
+      .args[1] = {.name = "x", .type = QCVM_FLOAT},
+      .args[2] = {.name = "y", .type = QCVM_FLOAT},
+  };
+
   qcvm_add_export(qcvm, &export_G_Map_SetTerrainType);
   qcvm_add_export(qcvm, &export_G_Map_GetTerrainType);
   qcvm_add_export(qcvm, &export_G_Map_AddWall);
+  qcvm_add_export(qcvm, &export_G_Map_IsReachable);
+  qcvm_add_export(qcvm, &export_G_Map_GetArea);
 }
\ No newline at end of file
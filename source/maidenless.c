@@ -55,6 +55,7 @@ int main(int argc, char **argv) {
     }
     CL_DrawClient(client, game, state);
     CL_UpdateClient(client);
+    C_ProfilerFrameEnd();
     frame++;
   }
   G_DestroyGame(game);
@@ -1,6 +1,7 @@
 #include "vk/vk_system.h"
 #include "vk/vk_private.h"
 #include "vk/vk_vulkan.h"
+#include <common/c_profiler.h>
 #include <common/c_terminal.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -932,8 +933,10 @@ void VK_TickSystems(vk_rend_t *rend) {
   // Apply all ECS writes
   // !TODO should probably consolidate the copies to avoid copying multiple
   // little region
+  unsigned long uploaded = 0;
   for (unsigned i = 0; i < rend->ecs->write_count; i++) {
     vk_write_t *write = &rend->ecs->writes[i];
+    uploaded += write->size;
     VkBufferCopy copy = {
         .size = write->size,
         .dstOffset = write->offset,
@@ -963,6 +966,7 @@ void VK_TickSystems(vk_rend_t *rend) {
   }
 
   rend->ecs->write_count = 0;
+  C_PROFILER_COUNT("ECS Bytes Uploaded", uploaded);
 
   VkBufferMemoryBarrier2 t_barrier = {
       .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2,